@@ -29,6 +29,7 @@ static inline void printHexToFile(FILE *, int);
 void firstPass(FILE *inFilePtr);
 void secondPass(FILE *inFilePtr, FILE *outFilePtr);
 static int isValidRegister(char *reg);
+static int maintenanceOffset(char *opcode);
 static int lineIsBlank(char *line);
 static int isAlpha(char c);
 static int isAlnum(char c);
@@ -147,7 +148,7 @@ void firstPass(FILE *inFilePtr)
             strcmp(opcode, "lw") == 0 || strcmp(opcode, "sw") == 0 ||
             strcmp(opcode, "beq") == 0 || strcmp(opcode, "jalr") == 0 ||
             strcmp(opcode, "halt") == 0 || strcmp(opcode, "noop") == 0 ||
-            strcmp(opcode, ".fill") == 0)
+            maintenanceOffset(opcode) || strcmp(opcode, ".fill") == 0)
         {
             address++;
         }
@@ -315,6 +316,18 @@ void secondPass(FILE *inFilePtr, FILE *outFilePtr)
         {
             machineCode = (7 << 22);
         }
+        else if (maintenanceOffset(opcode) & 0x4)
+        {
+            machineCode = (7 << 22) | maintenanceOffset(opcode);
+        }
+        else if (maintenanceOffset(opcode))
+        {
+            if (!isValidRegister(arg0) || !isValidRegister(arg1))
+            {
+                exit(1);
+            }
+            machineCode = (7 << 22) | (atoi(arg0) << 19) | (atoi(arg1) << 16) | maintenanceOffset(opcode);
+        }
         else if (strcmp(opcode, ".fill") == 0)
         {
             int fillValue;
@@ -381,6 +394,25 @@ static int isValidRegister(char *reg)
     return 1;
 }
 
+/*
+ * The offset a cache maintenance instruction puts in a noop, or 0 if
+ * opcode isn't one. cflush, cclean and cinval regA regB flush, clean or
+ * invalidate the reg[regB] words from the address in reg[regA]; the -all
+ * forms take no registers and cover the whole cache.
+ */
+static int maintenanceOffset(char *opcode)
+{
+    const char *names[] = {"cflush", "cclean", "cinval", "cflushall", "ccleanall", "cinvalall"};
+    for (int i = 0; i < 6; i++)
+    {
+        if (strcmp(opcode, names[i]) == 0)
+        {
+            return (i % 3 + 1) | (i >= 3 ? 0x4 : 0);
+        }
+    }
+    return 0;
+}
+
 // Returns non-zero if the line contains only whitespace.
 static int lineIsBlank(char *line)
 {
@@ -4,12 +4,55 @@
  * Instructions are found in the project spec.
  */
 
+// For pthreads and sched_yield under -std=c99
+#define _POSIX_C_SOURCE 200809L
+
 #include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <setjmp.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #define MAX_CACHE_SIZE 256
 #define MAX_BLOCK_SIZE 256
+#define MAX_OPTION_LENGTH 1000
+#define MAX_CORES 16
+#define MAX_THREADS 64
+#define MAX_MSHRS 64
+// Sector valid and dirty bits are kept in an unsigned int
+#define MAX_SECTORS 32
+// Programs sharing the cache; tenant t's word a is cache address
+// t * TENANT_SPACE + a, so tenants never share blocks
+#define MAX_TENANTS 8
+#define TENANT_SPACE 65536
+// Way partitions are kept as 64 bit masks
+#define MAX_PARTITION_WAYS 64
+// Accesses buffered between the dispatcher and each parallel replay worker
+#define REPLAY_QUEUE_SIZE 4096
+// cache_access_batch prefetches the set of the access this far ahead, and
+// at most this many of its most recently used ways
+#define BATCH_PREFETCH_DISTANCE 8
+#define BATCH_PREFETCH_WAYS 8
+// Accesses serial cache_replay collects before running them as a batch
+#define REPLAY_BATCH_SIZE 256
+// Skewed caches keep one hash table per way, and ZCache relocation looks
+// at most this many levels of candidates deep
+#define MAX_SKEWED_WAYS 16
+#define MAX_ZCACHE_LEVELS 3
+// Bytes of a tag the index hashes look at; tags stay below 2^24
+#define HASH_BYTES 3
+// Entries of the way predictor's table; ways fit in an unsigned char
+#define MAX_WAY_TABLE 4096
+// Eviction ages are bucketed by powers of 2: bucket b holds ages [2^b, 2^(b+1))
+#define AGE_BUCKETS 32
+// z-score for the 95% confidence intervals reported by sampled runs
+#define CONFIDENCE_Z 1.96
+// Tags the cache section of a checkpoint file; bump on layout changes
+#define CHECKPOINT_MAGIC 0x4C324B43
+#define CHECKPOINT_VERSION 8
 
 // **Note** this is a preprocessor macro. This is not the same as a function.
 // Powers of 2 have exactly one 1 and the rest 0's, and 0 isn't a power of 2.
@@ -30,6 +73,77 @@ extern int mem_access(int addr, int write_flag, int write_data);
  */
 extern int get_num_mem_accesses(void);
 
+/*
+ * Timing model of the memory behind mem_access, see memory.c.
+ * memory_transfer returns the latency of one block fill or writeback.
+ */
+extern int memory_set_option(const char *name, const char *value);
+extern void memory_init(int blockSize);
+extern int memory_transfer(int addr, int words, int write_flag);
+extern void memory_print_stats(void);
+extern void memory_checkpoint_save(FILE *out);
+extern void memory_checkpoint_load(FILE *in);
+extern void memory_clear_options(void);
+
+/*
+ * Compressed cache model, see compress.c. It shadows the cache's tags with
+ * a compressed data array and reports the capacity that would gain.
+ */
+extern int compress_set_option(const char *name, const char *value);
+extern int compress_init(int blockSize, int numSets, int blocksPerSet);
+extern void compress_access(int set, int tag, const int *data, int write_flag);
+extern void compress_invalidate(int set, int tag);
+extern int compress_holds(int set, int tag);
+extern void compress_invalidate_all(void);
+extern void compress_print_stats(long long realHits);
+extern void compress_clear_options(void);
+
+/*
+ * Reference model for verify=1, see oracle.c. oracle_check returns -1 if
+ * the access diverged from what the reference cache would have done.
+ */
+extern void oracle_init(int blockSize, int numSets, int blocksPerSet);
+extern int oracle_check(int addr, int write_flag, int write_data, int result, int hit, int way, int writeback);
+extern void oracle_maintain(int addr, int invalidate, int written_back);
+extern void oracle_print_stats(void);
+extern void oracle_checkpoint_save(FILE *out);
+extern void oracle_checkpoint_load(FILE *in);
+
+/*
+ * Reports a bad option, configuration or checkpoint: prints "error: " and the
+ * message and exits, unless a caller that has to survive it (libcachesim)
+ * passed a jmp_buf to cache_catch_errors. Then the message is kept for
+ * cache_error_message and the error jumps back to that caller instead.
+ */
+void cache_error(const char *format, ...) __attribute__((noreturn));
+
+static jmp_buf *errorJump = NULL;
+static char errorMessage[MAX_OPTION_LENGTH];
+
+void cache_catch_errors(jmp_buf *jump)
+{
+    errorJump = jump;
+}
+
+const char *cache_error_message(void)
+{
+    return errorMessage;
+}
+
+void cache_error(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vsnprintf(errorMessage, sizeof(errorMessage), format, args);
+    va_end(args);
+    if (errorJump != NULL)
+    {
+        longjmp(*errorJump, 1);
+    }
+    printf("error: %s\n", errorMessage);
+    exit(1);
+}
+
 // Use this when calling printAction. Do not modify the enumerated type below.
 enum actionType
 {
@@ -40,6 +154,29 @@ enum actionType
     cacheToNowhere
 };
 
+// Coherence state of a valid block in a multi-core run
+enum coherenceState
+{
+    coherenceShared,
+    coherenceExclusive,
+    coherenceOwned,
+    coherenceModified
+};
+
+/*
+ * Running sums for a ratio estimate of the miss rate over n samples,
+ * where sample i saw a_i accesses and m_i misses.
+ */
+typedef struct sampleStruct
+{
+    long long n;
+    double sumA;
+    double sumM;
+    double sumAA;
+    double sumMM;
+    double sumAM;
+} sampleStruct;
+
 /* You may add or remove variables from these structs */
 typedef struct blockStruct
 {
@@ -48,8 +185,35 @@ typedef struct blockStruct
     int lruLabel;
     int tag;
     int valid;
+    // Instrumentation: fills/hits over the whole run, hits since the last fill
+    int fills;
+    int totalHits;
+    int reuse;
+    long long fillTime;
+    // One bit per sector: which sectors hold data and which are dirty.
+    // dirty is set whenever any sector is.
+    unsigned int sectorValid;
+    unsigned int sectorDirty;
+    // Words the processor used since the fill, for the traffic stats
+    unsigned int touched[MAX_BLOCK_SIZE / 32];
+    // Only meaningful with more than one core. Owned and Modified are dirty.
+    enum coherenceState coherence;
+    // Tenant whose miss filled the block
+    int tenant;
+    // accessClock of the last access, for LRU across the sets of a skewed cache
+    long long lastUse;
 } blockStruct;
 
+// Statistics of one program sharing the cache
+typedef struct tenantStruct
+{
+    long long hits;
+    long long misses;
+    long long writebacks;
+    // Blocks of this tenant evicted to make room for another tenant's
+    long long evictedByOthers;
+} tenantStruct;
+
 typedef struct cacheStruct
 {
     blockStruct blocks[MAX_CACHE_SIZE];
@@ -60,216 +224,3159 @@ typedef struct cacheStruct
     int hits;
     int misses;
     int writebacks;
+    // The same stats split by the tenant that caused them
+    tenantStruct tenants[MAX_TENANTS];
+    // Per-set instrumentation for conflict heatmaps, dumped by printStats.
+    // accessClock counts every cache_access and timestamps fills.
+    long long accessClock;
+    long long setAccesses[MAX_CACHE_SIZE];
+    long long setMisses[MAX_CACHE_SIZE];
+    long long setEvictions[MAX_CACHE_SIZE];
+    long long setWritebacks[MAX_CACHE_SIZE];
+    long long evictionAges[AGE_BUCKETS];
+    // Sampled simulation: accesses that bypassed the cache model, and the
+    // per-unit samples collected by time sampling
+    long long unsampledAccesses;
+    int unitHits;
+    int unitMisses;
+    sampleStruct units;
+    // Snooping-bus traffic caused by this core, and snoops it answered
+    int busReads;
+    int busReadExclusives;
+    int busUpgrades;
+    int invalidationsReceived;
+    int transfersSupplied;
+    int snoopWritebacks;
+    // Model tags, LRU, dirty bits and stats only: no data, no mem_access and
+    // no printAction. Parallel replay workers can't share those.
+    int tagsOnly;
+    // Memory latency of the fill done by the last access, 0 if it hit
+    int lastFillCycles;
+    // Words moved between the cache and memory against words the processor
+    // used, and misses to a sector of a block that was present
+    long long wordsFilled;
+    long long wordsWrittenBack;
+    long long wordsUsed;
+    long long sectorMisses;
+    // Outcome of the last access for verify and MSHR timing: whether it
+    // hit, the way it hit or filled, and whether the victim was written back
+    int lastHit;
+    int lastWay;
+    int lastWriteback;
+    // The ways of each set from most to least recently used, set s's at
+    // recency[s * blocksPerSet]. Lookups probe in this order, so blocks a
+    // skewed workload keeps hitting are found first.
+    unsigned char recency[MAX_CACHE_SIZE];
+    // Way prediction: the last way used by each entry's addresses or pcs,
+    // tag probes the modelled lookup made, probes a way-order lookup would
+    // have made, and tag matches on the first probe
+    unsigned char wayTable[MAX_WAY_TABLE];
+    long long probes;
+    long long wayOrderProbes;
+    long long firstProbeHits;
+    // Blocks a ZCache miss moved to another way to make room
+    long long relocations;
+    // Valid dirty blocks, kept up to date on every change of a dirty bit
+    int dirtyBlocks;
 } cacheStruct;
 
+// Which way a lookup probes first, see the way-predict option
+enum wayPredictor
+{
+    predictNone,
+    predictMru,
+    predictAddress,
+    predictPc
+};
+
+// How block addresses map to sets, see the index-function option
+enum indexFunction
+{
+    indexModulo,
+    indexXor,
+    indexPrime,
+    indexSkewed
+};
+
+// How the ways of a set are divided between tenants
+enum partitionMode
+{
+    partitionNone,
+    partitionStatic,
+    partitionUtility
+};
+
+// Cache maintenance operations, see cache_maintain
+enum maintenance
+{
+    maintainFlush,
+    maintainClean,
+    maintainInvalidate,
+    NUM_MAINTENANCE
+};
+
+// What a series of maintenance operations did, over every core
+typedef struct maintenanceStruct
+{
+    long long operations[NUM_MAINTENANCE];
+    // Blocks and words written back, blocks invalidated, and dirty blocks
+    // invalidated without being written back
+    long long writebacks;
+    long long words;
+    long long invalidated;
+    long long discarded;
+} maintenanceStruct;
+
+// Counters at the start of the current statistics interval
+typedef struct intervalStruct
+{
+    long long accesses;
+    long long instructions;
+    int hits;
+    int misses;
+    int writebacks;
+} intervalStruct;
+
+// Receives the statistics of every interval, see cache_set_interval_hook
+typedef void (*cacheIntervalHook)(int interval, long long accesses, long long instructions, int hits,
+                                  int misses, int writebacks, int dirtyBlocks);
+
+// A miss status holding register: a block (or, with sectors, a sector)
+// fill still on its way. fillAddr is the address divided by the fill size.
+typedef struct mshrStruct
+{
+    int fillAddr;
+    long long readyAt;
+} mshrStruct;
+
 /* Global Cache variable */
 cacheStruct cache;
 
+// Private cache of each core; core 0 is always the global cache
+static cacheStruct *coreCaches[MAX_CORES] = {&cache};
+static int numCores = 1;
+// Host threads used by cache_replay
+static int numThreads = 1;
+// Words parallel replay workers moved to and from memory: they only model
+// tags, so they never call mem_access
+static long long replayMemoryWords = 0;
+
+/*
+ * Non-blocking cache timing for cache_access_timed. The MSHRs in use are
+ * the pending fill events; time only moves forward, and every advance
+ * retires the fills that completed, in completion order.
+ */
+static int numMshrs = 0;
+static int hitLatency = 1;
+static mshrStruct mshrs[MAX_MSHRS];
+static int mshrsInUse = 0;
+static long long mshrClock = 0;
+static long long primaryMisses = 0;
+static long long secondaryMisses = 0;
+static long long mshrFullCycles = 0;
+// Integral of MSHRs in use over time, and cycles with any in use
+static long long mshrOccupancy = 0;
+static long long mshrBusyCycles = 0;
+
+// Blocks are filled and written back in blockSize / sectorsPerBlock word
+// sectors; reportTraffic is set once the sectors option is given
+static int sectorsPerBlock = 1;
+static int reportTraffic = 0;
+
+// Whether compress_access shadows every access, see compress.c
+static int compressing = 0;
+
+// Check every access against the reference model in oracle.c
+static int verifying = 0;
+
+/*
+ * Tenants sharing the cache through cache_access_tenant. A tenant's misses
+ * may only fill the ways in its mask, but it hits wherever its blocks are.
+ * Utility-based partitioning recomputes the masks every ucpInterval
+ * accesses from utility monitors: a private LRU tag directory per tenant
+ * whose stack-position hit counts tell how many hits each extra way is
+ * worth to it.
+ */
+static int numTenants = 1;
+static int currentTenant = 0;
+static enum partitionMode partitionMode = partitionNone;
+static char wayMaskList[MAX_OPTION_LENGTH];
+static unsigned long long wayMasks[MAX_TENANTS];
+static int ucpInterval = 10000;
+static long long ucpAccesses = 0;
+static int ucpRepartitions = 0;
+static int umonTags[MAX_TENANTS][MAX_CACHE_SIZE];
+static long long umonHits[MAX_TENANTS][MAX_PARTITION_WAYS];
+
+// Way prediction settings, and the pc of the running access for
+// way-predict=pc, which the simulator reports through cache_set_pc
+static enum wayPredictor wayPredictor = predictNone;
+static int wayTableSize = 1024;
+static int accessPc = 0;
+
+/*
+ * Hashed indexing. A block address a splits into its low index bits and
+ * a tag t = a / numSets. xor and skewed index with the low bits XORed with
+ * a GF(2) bit-matrix hash of t, which indexTables holds precomputed one
+ * tag byte at a time: way w's hash of t is the XOR of
+ * indexTables[w][i][byte i of t] over the bytes. xor uses way 0's matrix,
+ * which folds the tag onto the index bits, for every way; skewed gives
+ * every other way its own random matrix. prime takes a modulo
+ * indexModulus, the largest prime no larger than numSets, instead.
+ */
+static enum indexFunction indexFunction = indexModulo;
+static int zcacheLevels = 1;
+static int indexModulus;
+static unsigned char indexTables[MAX_SKEWED_WAYS][HASH_BYTES][256];
+// Where each candidate of the last skewed victim search came from, -1 for
+// the block's own positions
+static int zcacheParent[MAX_CACHE_SIZE];
+
+// MOESI lets a Modified block answer a read by becoming Owned instead of
+// writing itself back
+static int moesi = 0;
+
+// Where printStats dumps the instrumentation; empty means no dump
+static char statsFile[MAX_OPTION_LENGTH];
+
+// Interval statistics: where the JSON lines go, the function a library
+// caller wants them passed to, how long an interval is and in which unit,
+// and where the next one ends. instructions counts cache_instruction calls.
+static char intervalFile[MAX_OPTION_LENGTH];
+static cacheIntervalHook intervalHook = NULL;
+static long long intervalLength = 100000;
+static int intervalByInstructions = 0;
+static FILE *intervalOut = NULL;
+static int trackingIntervals = 0;
+static long long instructions = 0;
+static long long nextInterval;
+static int intervalsReported;
+static intervalStruct intervalStart;
+
+// Sampled simulation settings, see cache_set_option
+static int sampleSets = 1;
+static int sampleInterval = 0;
+static int sampleUnit = 0;
+static int sampleWarmup = 0;
+
+// 0 while warming the cache up between sampling units: no stats, no printAction
+static int measuring = 1;
+
+// No printAction and no cache_init banner, for library runs
+static int quiet = 0;
+
+// Maintenance the program asked for, and the final flush of final-flush=1
+// once cache_final_flush has done it
+static maintenanceStruct maintenanceStats;
+static int finalFlush = 0;
+static int finalFlushed = 0;
+static maintenanceStruct finalFlushStats;
+
 void printAction(int, int, enum actionType);
 void printCache(void);
 
+// The index function's hash of tag for way, XORed into the index bits
+static int index_hash(int tag, int way)
+{
+    if (indexFunction == indexModulo || indexFunction == indexPrime)
+    {
+        return 0;
+    }
+    const unsigned char(*table)[256] = indexTables[indexFunction == indexSkewed ? way : 0];
+    return table[0][tag & 0xFF] ^ table[1][tag >> 8 & 0xFF] ^ table[2][tag >> 16 & 0xFF];
+}
+
 // Helper functions for cache addressing
-static int get_tag(int addr)
+static int get_tag(cacheStruct *c, int addr)
+{
+    return addr / c->blockSize / (indexFunction == indexPrime ? indexModulus : c->numSets);
+}
+
+// The set addr maps to in way; only a skewed cache's ways differ
+static int get_way_set_index(cacheStruct *c, int addr, int way)
+{
+    int block_addr = addr / c->blockSize;
+    if (indexFunction == indexPrime)
+    {
+        return block_addr % indexModulus;
+    }
+    return (block_addr % c->numSets) ^ index_hash(block_addr / c->numSets, way);
+}
+
+static int get_set_index(cacheStruct *c, int addr)
 {
-    return addr / (cache.blockSize * cache.numSets);
+    return get_way_set_index(c, addr, 0);
 }
 
-static int get_set_index(int addr)
+// The first word of the block held in c->blocks[block]
+static int get_block_addr(cacheStruct *c, int block)
 {
-    return (addr / cache.blockSize) % cache.numSets;
+    int set_index = block / c->blocksPerSet;
+    int tag = c->blocks[block].tag;
+    if (indexFunction == indexPrime)
+    {
+        return (tag * indexModulus + set_index) * c->blockSize;
+    }
+    int low = set_index ^ index_hash(tag, block % c->blocksPerSet);
+    return (tag * c->numSets + low) * c->blockSize;
 }
 
-static int get_block_offset(int addr)
+static int get_block_offset(cacheStruct *c, int addr)
 {
-    return addr % cache.blockSize;
+    return addr % c->blockSize;
 }
 
 /*
- * Set up the cache with given command line parameters. This is
- * called once in main(). You must implement this function.
+ * Set an optional cache feature before cache_init is called.
+ * Returns 0 if the option was recognized, -1 otherwise.
+ *  -    stats=<file>: dump per-set/per-block counters at printStats time,
+ *                    as JSON if file ends in .json and CSV otherwise
+ *  -    sample-sets=<k>: only simulate sets whose index is a multiple of k;
+ *                    other sets go straight to memory
+ *  -    sample-interval=<p>, sample-unit=<u>, sample-warmup=<w>: SMARTS-style
+ *                    time sampling. Of every p accesses, the last u are
+ *                    measured, the w before them warm the cache up without
+ *                    being counted, and the rest bypass the cache
+ *  -    cores=<n>: give each of n cores a private cache, kept coherent over
+ *                    a snooping bus. Use cache_access_core to pick the core
+ *  -    coherence=mesi|moesi: the protocol for cores > 1 (default mesi)
+ *  -    threads=<n>: host threads cache_replay spreads the sets over
+ *  -    mshrs=<n>: model a non-blocking cache with n MSHRs, for
+ *                    cache_access_timed
+ *  -    hit-latency=<cycles>: cache hit time for cache_access_timed (default 1)
+ *  -    sectors=<n>: split every block into n sectors with their own valid
+ *                    and dirty bits, and report words moved against words used
+ *  -    verify=1: run a reference model in lockstep and stop with a dump of
+ *                    the cache at the first access where they disagree
+ *  -    tenants=<n>: n programs share the cache, see cache_access_tenant
+ *  -    partition=none|static|ucp: divide the ways between tenants with
+ *                    the masks of way-masks, or by utility-based
+ *                    partitioning every ucp-interval accesses
+ *  -    way-masks=<hex>,<hex>,...: the ways each tenant may fill (bit w is
+ *                    way w), one mask per tenant
+ *  -    ucp-interval=<accesses>: how often ucp repartitions (default 10000)
+ *  -    index-function=modulo|xor|prime|skewed: how block addresses map
+ *                    to sets. xor XORs a fold of the tag into the index
+ *                    bits, prime takes the block address modulo the largest
+ *                    prime no larger than the number of sets, and skewed
+ *                    hashes every way differently (at most 16 ways)
+ *  -    zcache-levels=<n>: for skewed, how many levels of blocks a miss
+ *                    may move to other ways to keep a better block (default
+ *                    1, no relocation)
+ *  -    intervals=<file>: write the statistics of every interval to file as
+ *                    JSON lines: hits, misses, miss rate, writebacks, MPKI
+ *                    and the dirty blocks at its end
+ *  -    interval=<n>: the length of an interval (default 100000)
+ *  -    interval-unit=accesses|instructions: what interval counts (default
+ *                    accesses). Instructions, and MPKI, need the simulator
+ *                    to report each one with cache_instruction
+ *  -    quiet=1: don't call printAction or print the cache_init banner
+ *  -    final-flush=1: flush every cache when the program halts (see
+ *                    cache_final_flush), so writebacks and memory traffic
+ *                    include the dirty blocks the run would leave behind
+ *  -    way-predict=mru|address|pc: model a lookup that probes one
+ *                    predicted way first and the rest most recently used
+ *                    first, and report probes per access. mru predicts the
+ *                    set's MRU way; address and pc predict the way last used
+ *                    by the hashed block address or pc of the access
+ *  -    way-table=<entries>: size of the address and pc prediction table
+ *                    (default 1024)
+ * Anything else is passed on to the compression model in compress.c and
+ * then the memory timing model in memory.c.
  */
-void cache_init(int blockSize, int numSets, int blocksPerSet)
+int cache_set_option(const char *name, const char *value)
 {
-    if (blockSize <= 0 || numSets <= 0 || blocksPerSet <= 0)
+    if (strlen(value) >= MAX_OPTION_LENGTH)
     {
-        printf("error: input parameters must be positive numbers\n");
-        exit(1);
+        cache_error("value for option %s is too long", name);
     }
-    if (blocksPerSet * numSets > MAX_CACHE_SIZE)
+    if (!strcmp(name, "stats"))
     {
-        printf("error: cache must be no larger than %d blocks\n", MAX_CACHE_SIZE);
-        exit(1);
+        strcpy(statsFile, value);
+        return 0;
     }
-    if (blockSize > MAX_BLOCK_SIZE)
+    if (!strcmp(name, "sample-sets"))
     {
-        printf("error: blocks must be no larger than %d words\n", MAX_BLOCK_SIZE);
-        exit(1);
+        sampleSets = atoi(value);
+        return 0;
     }
-    if (!is_power_of_2(blockSize))
+    if (!strcmp(name, "sample-interval"))
     {
-        printf("warning: blockSize %d is not a power of 2\n", blockSize);
+        sampleInterval = atoi(value);
+        return 0;
     }
-    if (!is_power_of_2(numSets))
+    if (!strcmp(name, "sample-unit"))
     {
-        printf("warning: numSets %d is not a power of 2\n", numSets);
+        sampleUnit = atoi(value);
+        return 0;
     }
-    printf("Simulating a cache with %d total lines; each line has %d words\n",
-           numSets * blocksPerSet, blockSize);
-    printf("Each set in the cache contains %d lines; there are %d sets\n",
-           blocksPerSet, numSets);
-    // Initialize cache parameters
-    cache.blockSize = blockSize;
-    cache.numSets = numSets;
-    cache.blocksPerSet = blocksPerSet;
-    // Initialize statistics
-    cache.hits = 0;
-    cache.misses = 0;
-    cache.writebacks = 0;
-    // Initialize all cache blocks
-    for (int i = 0; i < numSets * blocksPerSet; i++)
+    if (!strcmp(name, "sample-warmup"))
+    {
+        sampleWarmup = atoi(value);
+        return 0;
+    }
+    if (!strcmp(name, "cores"))
+    {
+        numCores = atoi(value);
+        return 0;
+    }
+    if (!strcmp(name, "mshrs"))
+    {
+        numMshrs = atoi(value);
+        return 0;
+    }
+    if (!strcmp(name, "hit-latency"))
+    {
+        hitLatency = atoi(value);
+        return 0;
+    }
+    if (!strcmp(name, "sectors"))
+    {
+        sectorsPerBlock = atoi(value);
+        reportTraffic = 1;
+        return 0;
+    }
+    if (!strcmp(name, "verify"))
+    {
+        verifying = atoi(value);
+        return 0;
+    }
+    if (!strcmp(name, "tenants"))
+    {
+        numTenants = atoi(value);
+        return 0;
+    }
+    if (!strcmp(name, "partition"))
+    {
+        if (!strcmp(value, "none") || !strcmp(value, "static") || !strcmp(value, "ucp"))
+        {
+            partitionMode = !strcmp(value, "none") ? partitionNone
+                            : !strcmp(value, "static") ? partitionStatic
+                                                       : partitionUtility;
+            return 0;
+        }
+        cache_error("partition must be none, static or ucp");
+    }
+    if (!strcmp(name, "way-masks"))
+    {
+        strcpy(wayMaskList, value);
+        return 0;
+    }
+    if (!strcmp(name, "ucp-interval"))
+    {
+        ucpInterval = atoi(value);
+        return 0;
+    }
+    if (!strcmp(name, "index-function"))
+    {
+        if (!strcmp(value, "modulo") || !strcmp(value, "xor") || !strcmp(value, "prime") ||
+            !strcmp(value, "skewed"))
+        {
+            indexFunction = !strcmp(value, "modulo")  ? indexModulo
+                            : !strcmp(value, "xor")   ? indexXor
+                            : !strcmp(value, "prime") ? indexPrime
+                                                      : indexSkewed;
+            return 0;
+        }
+        cache_error("index-function must be modulo, xor, prime or skewed");
+    }
+    if (!strcmp(name, "zcache-levels"))
+    {
+        zcacheLevels = atoi(value);
+        return 0;
+    }
+    if (!strcmp(name, "way-predict"))
+    {
+        if (!strcmp(value, "none") || !strcmp(value, "mru") || !strcmp(value, "address") ||
+            !strcmp(value, "pc"))
+        {
+            wayPredictor = !strcmp(value, "none")      ? predictNone
+                           : !strcmp(value, "mru")     ? predictMru
+                           : !strcmp(value, "address") ? predictAddress
+                                                       : predictPc;
+            return 0;
+        }
+        cache_error("way-predict must be none, mru, address or pc");
+    }
+    if (!strcmp(name, "way-table"))
+    {
+        wayTableSize = atoi(value);
+        return 0;
+    }
+    if (!strcmp(name, "intervals"))
+    {
+        strcpy(intervalFile, value);
+        return 0;
+    }
+    if (!strcmp(name, "interval"))
+    {
+        intervalLength = atoll(value);
+        return 0;
+    }
+    if (!strcmp(name, "interval-unit"))
+    {
+        if (!strcmp(value, "accesses") || !strcmp(value, "instructions"))
+        {
+            intervalByInstructions = !strcmp(value, "instructions");
+            return 0;
+        }
+        cache_error("interval-unit must be accesses or instructions");
+    }
+    if (!strcmp(name, "quiet"))
+    {
+        quiet = atoi(value);
+        return 0;
+    }
+    if (!strcmp(name, "final-flush"))
+    {
+        finalFlush = atoi(value);
+        return 0;
+    }
+    if (!strcmp(name, "threads"))
+    {
+        numThreads = atoi(value);
+        return 0;
+    }
+    if (!strcmp(name, "coherence"))
+    {
+        if (!strcmp(value, "mesi") || !strcmp(value, "moesi"))
+        {
+            moesi = !strcmp(value, "moesi");
+            return 0;
+        }
+        cache_error("coherence must be mesi or moesi");
+    }
+    if (compress_set_option(name, value) == 0)
     {
-        cache.blocks[i].valid = 0;
-        cache.blocks[i].dirty = 0;
-        cache.blocks[i].lruLabel = 0;
-        cache.blocks[i].tag = 0;
+        return 0;
     }
+    return memory_set_option(name, value);
 }
 
-// Find the least recently used block in a set
-static int find_lru_block(int set_index)
+/*
+ * Put every option of the cache, the compression model and the memory
+ * model back to its default, so one process can run several differently
+ * configured simulations.
+ */
+void cache_clear_options(void)
 {
-    int set_start = set_index * cache.blocksPerSet;
-    int lru_block = set_start;
-    int highest_lru = cache.blocks[set_start].lruLabel;
-    for (int i = 1; i < cache.blocksPerSet; i++)
+    statsFile[0] = '\0';
+    intervalFile[0] = '\0';
+    intervalHook = NULL;
+    intervalLength = 100000;
+    intervalByInstructions = 0;
+    sampleSets = 1;
+    sampleInterval = 0;
+    sampleUnit = 0;
+    sampleWarmup = 0;
+    numCores = 1;
+    moesi = 0;
+    numThreads = 1;
+    numMshrs = 0;
+    hitLatency = 1;
+    sectorsPerBlock = 1;
+    reportTraffic = 0;
+    verifying = 0;
+    numTenants = 1;
+    partitionMode = partitionNone;
+    wayMaskList[0] = '\0';
+    ucpInterval = 10000;
+    wayPredictor = predictNone;
+    wayTableSize = 1024;
+    indexFunction = indexModulo;
+    zcacheLevels = 1;
+    quiet = 0;
+    finalFlush = 0;
+    compress_clear_options();
+    memory_clear_options();
+}
+
+// Give c the requested geometry and empty it
+static void reset_cache(cacheStruct *c, int blockSize, int numSets, int blocksPerSet)
+{
+    // Initialize cache parameters
+    c->blockSize = blockSize;
+    c->numSets = numSets;
+    c->blocksPerSet = blocksPerSet;
+    // Initialize statistics
+    c->hits = 0;
+    c->misses = 0;
+    c->writebacks = 0;
+    memset(c->tenants, 0, sizeof(c->tenants));
+    c->accessClock = 0;
+    memset(c->setAccesses, 0, sizeof(c->setAccesses));
+    memset(c->setMisses, 0, sizeof(c->setMisses));
+    memset(c->setEvictions, 0, sizeof(c->setEvictions));
+    memset(c->setWritebacks, 0, sizeof(c->setWritebacks));
+    memset(c->evictionAges, 0, sizeof(c->evictionAges));
+    c->unsampledAccesses = 0;
+    c->unitHits = 0;
+    c->unitMisses = 0;
+    memset(&c->units, 0, sizeof(c->units));
+    c->busReads = 0;
+    c->busReadExclusives = 0;
+    c->busUpgrades = 0;
+    c->invalidationsReceived = 0;
+    c->transfersSupplied = 0;
+    c->snoopWritebacks = 0;
+    c->tagsOnly = 0;
+    c->lastFillCycles = 0;
+    c->wordsFilled = 0;
+    c->wordsWrittenBack = 0;
+    c->wordsUsed = 0;
+    c->sectorMisses = 0;
+    c->probes = 0;
+    c->wayOrderProbes = 0;
+    c->firstProbeHits = 0;
+    c->relocations = 0;
+    c->dirtyBlocks = 0;
+    memset(c->wayTable, 0, sizeof(c->wayTable));
+    // Initialize all cache blocks
+    for (int i = 0; i < numSets * blocksPerSet; i++)
     {
-        int block = set_start + i;
-        if (cache.blocks[block].valid && cache.blocks[block].lruLabel > highest_lru)
-        {
-            highest_lru = cache.blocks[block].lruLabel;
-            lru_block = block;
-        }
+        c->recency[i] = i % blocksPerSet;
+        c->blocks[i].valid = 0;
+        c->blocks[i].dirty = 0;
+        c->blocks[i].lruLabel = 0;
+        c->blocks[i].tag = 0;
+        c->blocks[i].fills = 0;
+        c->blocks[i].totalHits = 0;
+        c->blocks[i].reuse = 0;
+        c->blocks[i].fillTime = 0;
+        c->blocks[i].sectorValid = 0;
+        c->blocks[i].sectorDirty = 0;
+        c->blocks[i].tenant = 0;
+        c->blocks[i].lastUse = 0;
     }
-    return lru_block;
 }
 
-// Update LRU labels for all blocks in a set (Ver 1's approach)
-static void update_lru(int set_index, int accessed_block)
+static int is_prime(int n)
 {
-    int set_start = set_index * cache.blocksPerSet;
-    for (int i = 0; i < cache.blocksPerSet; i++)
+    for (int d = 2; d * d <= n; d++)
     {
-        int block = set_start + i;
-        if (block != accessed_block && cache.blocks[block].valid)
+        if (n % d == 0)
         {
-            cache.blocks[block].lruLabel++;
+            return 0;
         }
     }
-    cache.blocks[accessed_block].lruLabel = 0;
+    return n >= 2;
 }
 
 /*
- * Access the cache. This is the main part of the project,
- * and should call printAction as is appropriate.
- * It should only call mem_access when absolutely necessary.
- * addr is a 16-bit LC2K word address.
- * write_flag is 0 for reads (fetch/lw) and 1 for writes (sw).
- * write_data is a word, and is only valid if write_flag is 1.
- * The return of mem_access is undefined if write_flag is 1.
- * Thus the return of cache_access is undefined if write_flag is 1.
+ * Check the index function and precompute its tables. Way 0's matrix
+ * sends tag bit j to index bit j % indexBits; the other ways' send every
+ * tag bit to a pseudo-random nonzero combination of index bits.
  */
-int cache_access(int addr, int write_flag, int write_data)
+static void init_index_function(int numSets, int blocksPerSet)
 {
-    int set_index = get_set_index(addr);
-    int tag = get_tag(addr);
-    int block_offset = get_block_offset(addr);
-    int set_start = set_index * cache.blocksPerSet;
-    int found_block = -1;
-
-    // Look for the block in the cache
-    for (int i = 0; i < cache.blocksPerSet; i++)
+    int indexBits = 0;
+    while ((1 << indexBits) < numSets)
     {
-        int block = set_start + i;
-        if (cache.blocks[block].valid && cache.blocks[block].tag == tag)
-        {
-            found_block = block;
-            cache.hits++;
-            break;
-        }
+        indexBits++;
+    }
+    if ((indexFunction == indexXor || indexFunction == indexSkewed) && !is_power_of_2(numSets))
+    {
+        cache_error("index-function=xor and skewed need a power of 2 number of sets");
+    }
+    if (indexFunction == indexSkewed && blocksPerSet > MAX_SKEWED_WAYS)
+    {
+        cache_error("index-function=skewed supports at most %d ways", MAX_SKEWED_WAYS);
+    }
+    if (zcacheLevels < 1 || zcacheLevels > MAX_ZCACHE_LEVELS ||
+        (zcacheLevels > 1 && indexFunction != indexSkewed))
+    {
+        cache_error("zcache-levels must be between 1 and %d, and above 1 only with index-function=skewed",
+                    MAX_ZCACHE_LEVELS);
+    }
+    if (indexFunction != indexModulo &&
+        (verifying || compressing || partitionMode != partitionNone || numThreads > 1))
+    {
+        cache_error("index functions other than modulo can't be combined with verify, compression, partition or threads");
+    }
+    if (indexFunction == indexSkewed && wayPredictor != predictNone)
+    {
+        cache_error("way-predict can't be combined with index-function=skewed");
     }
 
-    // Cache miss
-    if (found_block == -1)
+    indexModulus = numSets;
+    while (!is_prime(indexModulus) && indexModulus > 2)
     {
-        cache.misses++;
+        indexModulus--;
+    }
 
-        // Find a block to use (either empty or LRU)
-        found_block = -1;
-        for (int i = 0; i < cache.blocksPerSet; i++)
+    memset(indexTables, 0, sizeof(indexTables));
+    unsigned int seed = 0x9E3779B9u;
+    for (int way = 0; way < MAX_SKEWED_WAYS && indexBits; way++)
+    {
+        int column[8 * HASH_BYTES];
+        for (int bit = 0; bit < 8 * HASH_BYTES; bit++)
         {
-            if (!cache.blocks[set_start + i].valid)
+            column[bit] = 1 << (bit % indexBits);
+            while (way)
             {
-                found_block = set_start + i;
-                break;
+                seed ^= seed << 13;
+                seed ^= seed >> 17;
+                seed ^= seed << 5;
+                column[bit] = seed & ((1 << indexBits) - 1);
+                if (column[bit])
+                {
+                    break;
+                }
             }
         }
-        // If no empty block found, use LRU
-        if (found_block == -1)
-        {
-            found_block = find_lru_block(set_index);
-        }
-
-        // If block is dirty, write it back to memory
-        if (cache.blocks[found_block].valid && cache.blocks[found_block].dirty)
+        for (int byte = 0; byte < HASH_BYTES; byte++)
         {
-            int old_addr = (cache.blocks[found_block].tag * cache.numSets + set_index) * cache.blockSize;
-            cache.writebacks++;
-            printAction(old_addr, cache.blockSize, cacheToMemory);
-            for (int i = 0; i < cache.blockSize; i++)
+            for (int value = 0; value < 256; value++)
             {
-                mem_access(old_addr + i, 1, cache.blocks[found_block].data[i]);
+                for (int bit = 0; bit < 8; bit++)
+                {
+                    if (value >> bit & 1)
+                    {
+                        indexTables[way][byte][value] ^= column[8 * byte + bit];
+                    }
+                }
             }
         }
-        else if (cache.blocks[found_block].valid)
-        {
-            // If block is valid but not dirty, we still need to evict it
-            int old_addr = (cache.blocks[found_block].tag * cache.numSets + set_index) * cache.blockSize;
-            printAction(old_addr, cache.blockSize, cacheToNowhere);
-        }
-
-        // Read the new block from memory
-        int base_addr = (addr / cache.blockSize) * cache.blockSize;
-        printAction(base_addr, cache.blockSize, memoryToCache);
-        for (int i = 0; i < cache.blockSize; i++)
-        {
-            cache.blocks[found_block].data[i] = mem_access(base_addr + i, 0, 0);
-        }
-
-        cache.blocks[found_block].valid = 1;
-        cache.blocks[found_block].dirty = 0;
-        cache.blocks[found_block].tag = tag;
     }
+}
 
-    // Update LRU (using Ver 1's approach)
-    update_lru(set_index, found_block);
+// Split the ways of a set into contiguous masks of alloc[t] ways each
+static void set_way_masks(const int *alloc)
+{
+    int way = 0;
+    for (int t = 0; t < numTenants; t++)
+    {
+        wayMasks[t] = ((1ULL << alloc[t]) - 1) << way;
+        way += alloc[t];
+    }
+}
 
-    // Handle the actual access
-    if (write_flag)
+// Check the tenant and partitioning options and set the starting masks
+static void init_partitions(int blocksPerSet)
+{
+    if (numTenants < 1 || numTenants > MAX_TENANTS)
     {
-        printAction(addr, 1, processorToCache);
-        cache.blocks[found_block].data[block_offset] = write_data;
-        cache.blocks[found_block].dirty = 1;
-        return 0;
+        cache_error("tenants must be between 1 and %d", MAX_TENANTS);
     }
-    else
+    if (numTenants > 1 && (numCores > 1 || numThreads > 1 || numMshrs || verifying))
     {
-        printAction(addr, 1, cacheToProcessor);
-        return cache.blocks[found_block].data[block_offset];
+        cache_error("tenants can't be combined with cores, threads, mshrs or verify");
     }
-}
-
-/*
- * print end of run statistics like in the spec. **This is not required**,
+    if (partitionMode == partitionNone)
+    {
+        return;
+    }
+    if (numTenants < 2 || blocksPerSet < numTenants || blocksPerSet > MAX_PARTITION_WAYS)
+    {
+        cache_error("partition needs at least 2 tenants and between tenants and %d ways per set",
+                    MAX_PARTITION_WAYS);
+    }
+    unsigned long long allWays = blocksPerSet == 64 ? ~0ULL : (1ULL << blocksPerSet) - 1;
+    if (partitionMode == partitionStatic)
+    {
+        char *next = wayMaskList;
+        for (int t = 0; t < numTenants; t++)
+        {
+            char *end;
+            wayMasks[t] = strtoull(next, &end, 16);
+            if (end == next || !wayMasks[t] || (wayMasks[t] & ~allWays) ||
+                *end != (t + 1 < numTenants ? ',' : '\0'))
+            {
+                cache_error("way-masks needs one nonzero mask of the %d ways for each of the %d tenants",
+                            blocksPerSet, numTenants);
+            }
+            next = end + 1;
+        }
+        return;
+    }
+    if (ucpInterval <= 0)
+    {
+        cache_error("ucp-interval must be positive");
+    }
+    // Start from an even split until the monitors know better
+    int alloc[MAX_TENANTS];
+    for (int t = 0; t < numTenants; t++)
+    {
+        alloc[t] = blocksPerSet / numTenants + (t < blocksPerSet % numTenants);
+    }
+    set_way_masks(alloc);
+    memset(umonTags, -1, sizeof(umonTags));
+    memset(umonHits, 0, sizeof(umonHits));
+    ucpAccesses = 0;
+    ucpRepartitions = 0;
+}
+
+// Check the interval options and open the interval file
+static void init_intervals(void)
+{
+    if (intervalOut != NULL)
+    {
+        fclose(intervalOut);
+        intervalOut = NULL;
+    }
+    instructions = 0;
+    nextInterval = intervalLength;
+    intervalsReported = 0;
+    memset(&intervalStart, 0, sizeof(intervalStart));
+    trackingIntervals = intervalFile[0] || intervalHook != NULL;
+    if (!trackingIntervals)
+    {
+        return;
+    }
+    if (intervalLength <= 0 || numCores > 1 || numThreads > 1)
+    {
+        cache_error("interval must be positive, and intervals can't be combined with cores or threads");
+    }
+    if (!intervalFile[0])
+    {
+        return;
+    }
+    intervalOut = fopen(intervalFile, "w");
+    if (intervalOut == NULL)
+    {
+        cache_error("can't open %s", intervalFile);
+    }
+}
+
+/*
+ * Set up the cache with given command line parameters. This is
+ * called once in main(). You must implement this function.
+ */
+void cache_init(int blockSize, int numSets, int blocksPerSet)
+{
+    if (blockSize <= 0 || numSets <= 0 || blocksPerSet <= 0)
+    {
+        cache_error("input parameters must be positive numbers");
+    }
+    if (blocksPerSet * numSets > MAX_CACHE_SIZE)
+    {
+        cache_error("cache must be no larger than %d blocks", MAX_CACHE_SIZE);
+    }
+    if (blockSize > MAX_BLOCK_SIZE)
+    {
+        cache_error("blocks must be no larger than %d words", MAX_BLOCK_SIZE);
+    }
+    if (sampleSets <= 0 || sampleSets > numSets)
+    {
+        cache_error("sample-sets must be between 1 and the number of sets");
+    }
+    if (sampleInterval < 0 || sampleUnit < 0 || sampleWarmup < 0 ||
+        (sampleInterval && (sampleUnit <= 0 || sampleUnit + sampleWarmup > sampleInterval)))
+    {
+        cache_error("time sampling needs 0 < sample-unit and sample-unit + sample-warmup <= sample-interval");
+    }
+    if (numCores < 1 || numCores > MAX_CORES)
+    {
+        cache_error("cores must be between 1 and %d", MAX_CORES);
+    }
+    if (numCores > 1 && (sampleSets > 1 || sampleInterval))
+    {
+        cache_error("sampling is not supported with more than one core");
+    }
+    if (numThreads < 1 || numThreads > MAX_THREADS)
+    {
+        cache_error("threads must be between 1 and %d", MAX_THREADS);
+    }
+    if (numThreads > 1 && (numCores > 1 || sampleSets > 1 || sampleInterval))
+    {
+        cache_error("threads can't be combined with cores or sampling");
+    }
+    // A parallel replay only models tags, so a flush would write back data it never had
+    if (numThreads > 1 && finalFlush)
+    {
+        cache_error("threads can't be combined with final-flush");
+    }
+    if (numMshrs < 0 || numMshrs > MAX_MSHRS || hitLatency < 0)
+    {
+        cache_error("mshrs must be between 0 and %d and hit-latency can't be negative", MAX_MSHRS);
+    }
+    if (numMshrs && (numCores > 1 || numThreads > 1 || sampleSets > 1 || sampleInterval))
+    {
+        cache_error("mshrs can't be combined with cores, threads or sampling");
+    }
+    if (sectorsPerBlock < 1 || sectorsPerBlock > MAX_SECTORS || blockSize % sectorsPerBlock)
+    {
+        cache_error("sectors must be between 1 and %d and divide the block size", MAX_SECTORS);
+    }
+    if (reportTraffic && numCores > 1)
+    {
+        cache_error("sectors is not supported with more than one core");
+    }
+    if (wayTableSize < 1 || wayTableSize > MAX_WAY_TABLE)
+    {
+        cache_error("way-table must be between 1 and %d", MAX_WAY_TABLE);
+    }
+    if ((wayPredictor == predictAddress || wayPredictor == predictPc) && numThreads > 1)
+    {
+        cache_error("way-predict=address and pc can't be combined with threads");
+    }
+    if (!is_power_of_2(blockSize))
+    {
+        printf("warning: blockSize %d is not a power of 2\n", blockSize);
+    }
+    if (!is_power_of_2(numSets))
+    {
+        printf("warning: numSets %d is not a power of 2\n", numSets);
+    }
+    if (!quiet)
+    {
+        printf("Simulating a cache with %d total lines; each line has %d words\n",
+               numSets * blocksPerSet, blockSize);
+        printf("Each set in the cache contains %d lines; there are %d sets\n",
+               blocksPerSet, numSets);
+    }
+    if (numCores > 1 && !quiet)
+    {
+        printf("Each of the %d cores has a private cache, kept coherent with %s\n",
+               numCores, moesi ? "MOESI" : "MESI");
+    }
+    compressing = compress_init(blockSize, numSets, blocksPerSet);
+    if (compressing && (numCores > 1 || numThreads > 1 || sampleSets > 1 || sampleInterval || sectorsPerBlock > 1))
+    {
+        cache_error("compression can't be combined with cores, threads, sampling or sectors");
+    }
+    if (verifying && (numCores > 1 || numThreads > 1 || sampleSets > 1 || sampleInterval || sectorsPerBlock > 1))
+    {
+        cache_error("verify can't be combined with cores, threads, sampling or sectors");
+    }
+    if (verifying)
+    {
+        oracle_init(blockSize, numSets, blocksPerSet);
+    }
+    if (numTenants > 1 && !is_power_of_2(blockSize))
+    {
+        cache_error("tenants need a power of 2 block size, so no block spans two tenants");
+    }
+    init_partitions(blocksPerSet);
+    init_index_function(numSets, blocksPerSet);
+    init_intervals();
+    currentTenant = 0;
+    accessPc = 0;
+    measuring = 1;
+    mshrsInUse = 0;
+    mshrClock = 0;
+    primaryMisses = 0;
+    secondaryMisses = 0;
+    mshrFullCycles = 0;
+    mshrOccupancy = 0;
+    mshrBusyCycles = 0;
+    replayMemoryWords = 0;
+    memset(&maintenanceStats, 0, sizeof(maintenanceStats));
+    memset(&finalFlushStats, 0, sizeof(finalFlushStats));
+    finalFlushed = 0;
+    memory_init(blockSize);
+    for (int core = 0; core < numCores; core++)
+    {
+        if (coreCaches[core] == NULL)
+        {
+            coreCaches[core] = malloc(sizeof(cacheStruct));
+            if (coreCaches[core] == NULL)
+            {
+                cache_error("out of memory for the cache of core %d", core);
+            }
+        }
+        reset_cache(coreCaches[core], blockSize, numSets, blocksPerSet);
+    }
+}
+
+// Index into evictionAges for a block that lived for age accesses
+static int age_bucket(long long age)
+{
+    int bucket = 0;
+    while (age > 1 && bucket < AGE_BUCKETS - 1)
+    {
+        age >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+/*
+ * Statistics bookkeeping for cache_access. None of these count anything
+ * while the cache is being warmed up between sampling units.
+ */
+static void record_hit(cacheStruct *c, int set_index, int block)
+{
+    if (!measuring)
+    {
+        return;
+    }
+    c->hits++;
+    c->unitHits++;
+    c->tenants[currentTenant].hits++;
+    c->setAccesses[set_index]++;
+    c->blocks[block].totalHits++;
+}
+
+static void record_miss(cacheStruct *c, int set_index)
+{
+    if (!measuring)
+    {
+        return;
+    }
+    c->misses++;
+    c->unitMisses++;
+    c->tenants[currentTenant].misses++;
+    c->setAccesses[set_index]++;
+    c->setMisses[set_index]++;
+}
+
+// Count the writeback of a dirty block against its set and its tenant
+static void record_writeback(cacheStruct *c, int set_index, int block)
+{
+    if (!measuring)
+    {
+        return;
+    }
+    c->writebacks++;
+    c->setWritebacks[set_index]++;
+    c->tenants[c->blocks[block].tenant].writebacks++;
+}
+
+// Count the eviction of a valid block against its set
+static void record_eviction(cacheStruct *c, int set_index, int block, int writeback)
+{
+    if (!measuring)
+    {
+        return;
+    }
+    if (writeback)
+    {
+        record_writeback(c, set_index, block);
+    }
+    if (c->blocks[block].tenant != currentTenant)
+    {
+        c->tenants[c->blocks[block].tenant].evictedByOthers++;
+    }
+    c->setEvictions[set_index]++;
+    c->evictionAges[age_bucket(c->accessClock - c->blocks[block].fillTime)]++;
+}
+
+static void record_fill(cacheStruct *c, int block)
+{
+    if (measuring)
+    {
+        c->blocks[block].fills++;
+    }
+}
+
+// printAction, except while warming up between sampling units
+static void log_action(cacheStruct *c, int address, int size, enum actionType type)
+{
+    if (measuring && !c->tagsOnly && !quiet)
+    {
+        printAction(address, size, type);
+    }
+}
+
+static void add_sample(sampleStruct *sample, double accesses, double misses)
+{
+    sample->n++;
+    sample->sumA += accesses;
+    sample->sumM += misses;
+    sample->sumAA += accesses * accesses;
+    sample->sumMM += misses * misses;
+    sample->sumAM += accesses * misses;
+}
+
+/*
+ * Ratio estimate of the miss rate from sample, with the half width of
+ * its 95% confidence interval in *halfWidth (-1 if there are too few
+ * samples). population is the number of samples that could have been
+ * drawn, for the finite population correction.
+ */
+static double estimate_miss_rate(const sampleStruct *sample, double population, double *halfWidth)
+{
+    *halfWidth = -1;
+    if (sample->sumA == 0)
+    {
+        return 0;
+    }
+    double rate = sample->sumM / sample->sumA;
+    if (sample->n >= 2)
+    {
+        double n = (double)sample->n;
+        double meanA = sample->sumA / n;
+        double residuals = sample->sumMM - 2 * rate * sample->sumAM + rate * rate * sample->sumAA;
+        double fpc = population > n ? 1 - n / population : 0;
+        *halfWidth = CONFIDENCE_Z * sqrt(fpc * residuals / (n - 1) / n) / meanA;
+    }
+    return rate;
+}
+
+/*
+ * Write every dirty block back and invalidate the whole cache without
+ * logging or counting anything. Used when time sampling stops simulating
+ * the cache, so memory is up to date while accesses bypass it.
+ */
+static void flush_silently(cacheStruct *c)
+{
+    for (int block = 0; block < c->numSets * c->blocksPerSet; block++)
+    {
+        if (c->blocks[block].valid && c->blocks[block].dirty)
+        {
+            int old_addr = get_block_addr(c, block);
+            int sector_words = c->blockSize / sectorsPerBlock;
+            for (int i = 0; i < c->blockSize; i++)
+            {
+                if (c->blocks[block].sectorDirty >> (i / sector_words) & 1)
+                {
+                    mem_access(old_addr + i, 1, c->blocks[block].data[i]);
+                }
+            }
+        }
+        c->blocks[block].valid = 0;
+        c->blocks[block].dirty = 0;
+        c->blocks[block].lruLabel = 0;
+    }
+    c->dirtyBlocks = 0;
+}
+
+// Count c's dirty blocks from scratch, after its blocks were replaced wholesale
+static void recount_dirty_blocks(cacheStruct *c)
+{
+    c->dirtyBlocks = 0;
+    for (int i = 0; i < c->numSets * c->blocksPerSet; i++)
+    {
+        c->dirtyBlocks += c->blocks[i].valid && c->blocks[i].dirty;
+    }
+}
+
+/*
+ * Index of the valid block of a set holding tag, or -1 if there is none.
+ * Ways are probed most recently used first; *probed is set to the number
+ * of ways looked at.
+ */
+static int lookup(cacheStruct *c, int set_index, int tag, int *probed)
+{
+    int set_start = set_index * c->blocksPerSet;
+    const unsigned char *order = &c->recency[set_start];
+    for (int i = 0; i < c->blocksPerSet; i++)
+    {
+        int block = set_start + order[i];
+        if (c->blocks[block].valid && c->blocks[block].tag == tag)
+        {
+            *probed = i + 1;
+            return block;
+        }
+    }
+    *probed = c->blocksPerSet;
+    return -1;
+}
+
+// lookup for a skewed cache, which probes addr's set in every way in turn
+static int lookup_skewed(cacheStruct *c, int addr, int *probed)
+{
+    int tag = get_tag(c, addr);
+    for (int way = 0; way < c->blocksPerSet; way++)
+    {
+        int block = get_way_set_index(c, addr, way) * c->blocksPerSet + way;
+        if (c->blocks[block].valid && c->blocks[block].tag == tag)
+        {
+            *probed = way + 1;
+            return block;
+        }
+    }
+    *probed = c->blocksPerSet;
+    return -1;
+}
+
+// Index of the valid block holding addr in c, or -1 if there is none
+static int find_block(cacheStruct *c, int addr)
+{
+    int probed;
+    if (indexFunction == indexSkewed)
+    {
+        return lookup_skewed(c, addr, &probed);
+    }
+    return lookup(c, get_set_index(c, addr), get_tag(c, addr), &probed);
+}
+
+// The wayTable entry predicting the way of an access to addr
+static int way_table_index(cacheStruct *c, int addr)
+{
+    unsigned int key = wayPredictor == predictPc ? (unsigned int)accessPc : (unsigned int)(addr / c->blockSize);
+    return (key * 2654435761u >> 16) % wayTableSize;
+}
+
+/*
+ * Count the tag probes of the modelled lookup of addr, which lookup found
+ * in found_block (or not, if -1) after probing probed ways MRU first. The
+ * predicted way is probed first, then the others MRU first; a miss probes
+ * every way. wayOrderProbes counts what probing in way order would cost.
+ */
+static void record_probes(cacheStruct *c, int set_index, int addr, int found_block, int probed)
+{
+    if (!measuring)
+    {
+        return;
+    }
+    int set_start = set_index * c->blocksPerSet;
+    if (found_block == -1)
+    {
+        c->probes += c->blocksPerSet;
+        c->wayOrderProbes += c->blocksPerSet;
+        return;
+    }
+    int way = found_block - set_start;
+    int probes = probed;
+    if (wayPredictor != predictMru)
+    {
+        int predicted = c->wayTable[way_table_index(c, addr)];
+        probes = predicted == way ? 1 : probed + 1;
+        for (int i = 0; i < probed - 1 && probes > 1; i++)
+        {
+            // Already probed first, so it isn't probed again in MRU order
+            if (c->recency[set_start + i] == predicted)
+            {
+                probes = probed;
+            }
+        }
+    }
+    c->probes += probes;
+    c->wayOrderProbes += way + 1;
+    if (probes == 1)
+    {
+        c->firstProbeHits++;
+    }
+}
+
+/*
+ * Broadcast a bus read (exclusive = 0) or read-for-ownership (exclusive = 1)
+ * of the block at base_addr from requester, and let every other core snoop it.
+ * A Modified or Owned copy supplies its data into data and 1 is returned;
+ * otherwise the data has to come from memory. *shared is set if any other
+ * copy survives the snoop.
+ */
+static int snoop_bus(cacheStruct *requester, int base_addr, int exclusive, int *data, int *shared)
+{
+    int supplied = 0;
+    *shared = 0;
+    if (exclusive)
+    {
+        requester->busReadExclusives++;
+    }
+    else
+    {
+        requester->busReads++;
+    }
+    for (int core = 0; core < numCores; core++)
+    {
+        cacheStruct *peer = coreCaches[core];
+        int block = peer == requester ? -1 : find_block(peer, base_addr);
+        if (block == -1)
+        {
+            continue;
+        }
+        blockStruct *b = &peer->blocks[block];
+        if (b->coherence == coherenceModified || b->coherence == coherenceOwned)
+        {
+            memcpy(data, b->data, peer->blockSize * sizeof(int));
+            peer->transfersSupplied++;
+            supplied = 1;
+            if (!exclusive && b->coherence == coherenceModified && moesi)
+            {
+                b->coherence = coherenceOwned;
+            }
+            else if (!exclusive && b->coherence == coherenceModified)
+            {
+                // MESI has no Owned state, so memory must be updated first
+                memory_transfer(base_addr, peer->blockSize, 1);
+                for (int i = 0; i < peer->blockSize; i++)
+                {
+                    mem_access(base_addr + i, 1, b->data[i]);
+                }
+                peer->snoopWritebacks++;
+                peer->dirtyBlocks -= b->dirty;
+                b->dirty = 0;
+                b->sectorDirty = 0;
+                b->coherence = coherenceShared;
+            }
+        }
+        else if (!exclusive)
+        {
+            b->coherence = coherenceShared;
+        }
+        if (exclusive)
+        {
+            peer->dirtyBlocks -= b->dirty;
+            b->valid = 0;
+            b->dirty = 0;
+            peer->invalidationsReceived++;
+        }
+        else
+        {
+            *shared = 1;
+        }
+    }
+    return supplied;
+}
+
+// Invalidate every other copy of the block at base_addr before requester writes it
+static void bus_upgrade(cacheStruct *requester, int base_addr)
+{
+    requester->busUpgrades++;
+    for (int core = 0; core < numCores; core++)
+    {
+        cacheStruct *peer = coreCaches[core];
+        int block = peer == requester ? -1 : find_block(peer, base_addr);
+        if (block != -1)
+        {
+            peer->dirtyBlocks -= peer->blocks[block].dirty;
+            peer->blocks[block].valid = 0;
+            peer->blocks[block].dirty = 0;
+            peer->invalidationsReceived++;
+        }
+    }
+}
+
+// Whether an access to addr would hit, without changing anything
+static int would_hit(cacheStruct *c, int addr)
+{
+    int block = find_block(c, addr);
+    int sector = get_block_offset(c, addr) / (c->blockSize / sectorsPerBlock);
+    return block != -1 && (c->blocks[block].sectorValid >> sector & 1);
+}
+
+// Find the least recently used block in a set
+static int find_lru_block(cacheStruct *c, int set_index)
+{
+    int set_start = set_index * c->blocksPerSet;
+    int lru_block = set_start;
+    int highest_lru = c->blocks[set_start].lruLabel;
+    for (int i = 1; i < c->blocksPerSet; i++)
+    {
+        int block = set_start + i;
+        if (c->blocks[block].valid && c->blocks[block].lruLabel > highest_lru)
+        {
+            highest_lru = c->blocks[block].lruLabel;
+            lru_block = block;
+        }
+    }
+    return lru_block;
+}
+
+/*
+ * The victim of a miss to addr in a skewed cache. The candidates are the
+ * block's position in every way and then, ZCache style, for each further
+ * level, the positions the blocks in the last level's candidates could
+ * move to in their other ways. The first empty candidate wins, or else the
+ * least recently used. zcacheParent records how to move blocks out of the
+ * way; see relocate.
+ */
+static int choose_skewed_victim(cacheStruct *c, int addr)
+{
+    int candidates[MAX_CACHE_SIZE];
+    char seen[MAX_CACHE_SIZE] = {0};
+    int count = 0;
+    for (int way = 0; way < c->blocksPerSet; way++)
+    {
+        int block = get_way_set_index(c, addr, way) * c->blocksPerSet + way;
+        zcacheParent[block] = -1;
+        seen[block] = 1;
+        candidates[count++] = block;
+        if (!c->blocks[block].valid)
+        {
+            return block;
+        }
+    }
+    int levelStart = 0;
+    for (int level = 1; level < zcacheLevels; level++)
+    {
+        int levelEnd = count;
+        for (int i = levelStart; i < levelEnd; i++)
+        {
+            int from = candidates[i];
+            int from_addr = get_block_addr(c, from);
+            for (int way = 0; way < c->blocksPerSet; way++)
+            {
+                int block = get_way_set_index(c, from_addr, way) * c->blocksPerSet + way;
+                if (seen[block])
+                {
+                    continue;
+                }
+                zcacheParent[block] = from;
+                seen[block] = 1;
+                candidates[count++] = block;
+                if (!c->blocks[block].valid)
+                {
+                    return block;
+                }
+            }
+        }
+        levelStart = levelEnd;
+    }
+    int victim = candidates[0];
+    for (int i = 1; i < count; i++)
+    {
+        if (c->blocks[candidates[i]].lastUse < c->blocks[victim].lastUse)
+        {
+            victim = candidates[i];
+        }
+    }
+    return victim;
+}
+
+/*
+ * Make room for a skewed fill once the victim chosen by
+ * choose_skewed_victim is gone: move each block on the path from the
+ * victim back to the missing block's own positions one step down it.
+ * Returns the position freed for the fill. Per-position counters stay put.
+ */
+static int relocate(cacheStruct *c, int victim)
+{
+    int block = victim;
+    while (zcacheParent[block] != -1)
+    {
+        blockStruct *to = &c->blocks[block];
+        int fills = to->fills;
+        int totalHits = to->totalHits;
+        *to = c->blocks[zcacheParent[block]];
+        to->fills = fills;
+        to->totalHits = totalHits;
+        if (measuring)
+        {
+            c->relocations++;
+        }
+        block = zcacheParent[block];
+    }
+    return block;
+}
+
+/*
+ * The block a miss of the running tenant fills: the first empty way it may
+ * use, or else the least recently used of those ways.
+ */
+static int choose_victim(cacheStruct *c, int set_index, int addr)
+{
+    int set_start = set_index * c->blocksPerSet;
+    if (indexFunction == indexSkewed)
+    {
+        return choose_skewed_victim(c, addr);
+    }
+    if (partitionMode == partitionNone)
+    {
+        for (int i = 0; i < c->blocksPerSet; i++)
+        {
+            if (!c->blocks[set_start + i].valid)
+            {
+                return set_start + i;
+            }
+        }
+        return find_lru_block(c, set_index);
+    }
+    int victim = -1;
+    for (int i = 0; i < c->blocksPerSet; i++)
+    {
+        if (!(wayMasks[currentTenant] >> i & 1))
+        {
+            continue;
+        }
+        if (!c->blocks[set_start + i].valid)
+        {
+            return set_start + i;
+        }
+        if (victim == -1 || c->blocks[set_start + i].lruLabel > c->blocks[victim].lruLabel)
+        {
+            victim = set_start + i;
+        }
+    }
+    return victim;
+}
+
+/*
+ * Update LRU labels (Ver 1's approach) and move the block to the front of
+ * the set's recency order. Only the blocks more recent than the accessed
+ * one age, unless it was an empty way, which every valid block is more
+ * recent than. So without invalidations by other cores the labels of a
+ * set's valid blocks are always 0, 1, 2, ... in recency order.
+ */
+static void update_lru(cacheStruct *c, int set_index, int accessed_block, int was_empty)
+{
+    int set_start = set_index * c->blocksPerSet;
+    unsigned char *order = &c->recency[set_start];
+    int position = 0;
+    for (; order[position] != accessed_block - set_start; position++)
+    {
+        if (c->blocks[set_start + order[position]].valid)
+        {
+            c->blocks[set_start + order[position]].lruLabel++;
+        }
+    }
+    for (int i = position + 1; was_empty && i < c->blocksPerSet; i++)
+    {
+        if (c->blocks[set_start + order[i]].valid)
+        {
+            c->blocks[set_start + order[i]].lruLabel++;
+        }
+    }
+    c->blocks[accessed_block].lruLabel = 0;
+    memmove(order + 1, order, position);
+    order[0] = accessed_block - set_start;
+}
+
+/*
+ * Move the sectors of block selected by mask between the cache and memory,
+ * one transfer per run of adjacent sectors. base_addr is the block's first
+ * word. Returns the memory latency of the transfers.
+ */
+static int transfer_sectors(cacheStruct *c, int block, int base_addr, unsigned int mask, enum actionType type)
+{
+    int sector_words = c->blockSize / sectorsPerBlock;
+    int cycles = 0;
+    for (int first = 0; first < sectorsPerBlock; first++)
+    {
+        if (!(mask >> first & 1))
+        {
+            continue;
+        }
+        int end = first + 1;
+        while (end < sectorsPerBlock && mask >> end & 1)
+        {
+            end++;
+        }
+        int addr = base_addr + first * sector_words;
+        int words = (end - first) * sector_words;
+        log_action(c, addr, words, type);
+        if (measuring && type == memoryToCache)
+        {
+            c->wordsFilled += words;
+        }
+        else if (measuring && type == cacheToMemory)
+        {
+            c->wordsWrittenBack += words;
+        }
+        if (!c->tagsOnly && type == memoryToCache)
+        {
+            cycles += memory_transfer(addr, words, 0);
+            for (int i = first * sector_words; i < end * sector_words; i++)
+            {
+                c->blocks[block].data[i] = mem_access(base_addr + i, 0, 0);
+            }
+        }
+        else if (!c->tagsOnly && type == cacheToMemory)
+        {
+            cycles += memory_transfer(addr, words, 1);
+            for (int i = first * sector_words; i < end * sector_words; i++)
+            {
+                mem_access(base_addr + i, 1, c->blocks[block].data[i]);
+            }
+        }
+        first = end;
+    }
+    return cycles;
+}
+
+// Run one access through the cache model
+static int simulate_access(cacheStruct *c, int addr, int write_flag, int write_data)
+{
+    // A skewed cache counts accesses against the set of way 0
+    int set_index = get_set_index(c, addr);
+    int tag = get_tag(c, addr);
+    int block_offset = get_block_offset(c, addr);
+    int base_addr = addr - block_offset;
+    unsigned int sector = 1u << (block_offset / (c->blockSize / sectorsPerBlock));
+    int probed;
+
+    c->lastFillCycles = 0;
+
+    // Look for the block in the cache
+    int found_block = indexFunction == indexSkewed ? lookup_skewed(c, addr, &probed)
+                                                   : lookup(c, set_index, tag, &probed);
+    int was_empty = 0;
+    if (wayPredictor != predictNone)
+    {
+        record_probes(c, set_index, addr, found_block, probed);
+    }
+
+    c->lastHit = found_block != -1 && (c->blocks[found_block].sectorValid & sector);
+    c->lastWriteback = 0;
+    if (c->lastHit)
+    {
+        record_hit(c, set_index, found_block);
+        c->blocks[found_block].reuse++;
+    }
+    else if (found_block != -1)
+    {
+        // The block is here but this sector isn't: fetch just the sector
+        record_miss(c, set_index);
+        if (measuring)
+        {
+            c->sectorMisses++;
+        }
+        c->lastFillCycles = transfer_sectors(c, found_block, base_addr, sector, memoryToCache);
+        c->blocks[found_block].sectorValid |= sector;
+    }
+    else
+    {
+        // Cache miss
+        record_miss(c, set_index);
+
+        // Find a block to use (either empty or LRU)
+        found_block = choose_victim(c, set_index, addr);
+        was_empty = !c->blocks[found_block].valid;
+
+        // If block is dirty, write its dirty sectors back to memory
+        blockStruct *victim = &c->blocks[found_block];
+        int victim_set = found_block / c->blocksPerSet;
+        int old_addr = get_block_addr(c, found_block);
+        if (victim->valid && victim->dirty)
+        {
+            c->lastWriteback = 1;
+            c->dirtyBlocks--;
+            record_eviction(c, victim_set, found_block, 1);
+            transfer_sectors(c, found_block, old_addr, victim->sectorDirty, cacheToMemory);
+        }
+        else if (victim->valid)
+        {
+            // If block is valid but not dirty, we still need to evict it
+            record_eviction(c, victim_set, found_block, 0);
+            transfer_sectors(c, found_block, old_addr, victim->sectorValid, cacheToNowhere);
+        }
+        if (indexFunction == indexSkewed)
+        {
+            found_block = relocate(c, found_block);
+        }
+
+        // Read the new sector from memory, or the block from another core's
+        // dirty copy (there is only one sector per block with several cores)
+        int shared = 0;
+        if (numCores > 1 && !c->tagsOnly &&
+            snoop_bus(c, base_addr, write_flag, c->blocks[found_block].data, &shared))
+        {
+            log_action(c, base_addr, c->blockSize, memoryToCache);
+        }
+        else
+        {
+            c->lastFillCycles = transfer_sectors(c, found_block, base_addr, sector, memoryToCache);
+        }
+
+        c->blocks[found_block].coherence = shared ? coherenceShared : coherenceExclusive;
+        c->blocks[found_block].tenant = currentTenant;
+        c->blocks[found_block].valid = 1;
+        c->blocks[found_block].dirty = 0;
+        c->blocks[found_block].sectorValid = sector;
+        c->blocks[found_block].sectorDirty = 0;
+        memset(c->blocks[found_block].touched, 0, sizeof(c->blocks[found_block].touched));
+        c->blocks[found_block].tag = tag;
+        record_fill(c, found_block);
+        c->blocks[found_block].reuse = 0;
+        c->blocks[found_block].fillTime = c->accessClock;
+    }
+
+    c->lastWay = found_block % c->blocksPerSet;
+    if (wayPredictor == predictAddress || wayPredictor == predictPc)
+    {
+        c->wayTable[way_table_index(c, addr)] = c->lastWay;
+    }
+    unsigned int *touched = &c->blocks[found_block].touched[block_offset / 32];
+    if (measuring && !(*touched >> (block_offset % 32) & 1))
+    {
+        *touched |= 1u << (block_offset % 32);
+        c->wordsUsed++;
+    }
+
+    // Update LRU (using Ver 1's approach). The ways of a skewed cache's
+    // sets hold unrelated blocks, so only lastUse orders them.
+    c->blocks[found_block].lastUse = c->accessClock;
+    if (indexFunction != indexSkewed)
+    {
+        update_lru(c, found_block / c->blocksPerSet, found_block, was_empty);
+    }
+
+    // Handle the actual access
+    if (write_flag)
+    {
+        if (numCores > 1 && (c->blocks[found_block].coherence == coherenceShared ||
+                             c->blocks[found_block].coherence == coherenceOwned))
+        {
+            bus_upgrade(c, addr - block_offset);
+        }
+        log_action(c, addr, 1, processorToCache);
+        c->blocks[found_block].data[block_offset] = write_data;
+        c->dirtyBlocks += !c->blocks[found_block].dirty;
+        c->blocks[found_block].dirty = 1;
+        c->blocks[found_block].sectorDirty |= sector;
+        c->blocks[found_block].coherence = coherenceModified;
+        return 0;
+    }
+    else
+    {
+        log_action(c, addr, 1, cacheToProcessor);
+        return c->blocks[found_block].data[block_offset];
+    }
+}
+
+/*
+ * Write the statistics of the interval that ended after accessesDone
+ * accesses as a JSON line, and start the next one. Everything is a
+ * difference of running counters, so intervals cost nothing per access.
+ */
+static void report_interval(long long accessesDone)
+{
+    cacheStruct *c = &cache;
+    long long accesses = accessesDone - intervalStart.accesses;
+    long long retired = instructions - intervalStart.instructions;
+    int hits = c->hits - intervalStart.hits;
+    int misses = c->misses - intervalStart.misses;
+    int writebacks = c->writebacks - intervalStart.writebacks;
+    if (intervalHook != NULL)
+    {
+        intervalHook(intervalsReported, accesses, retired, hits, misses, writebacks, c->dirtyBlocks);
+    }
+    if (intervalOut != NULL)
+    {
+        fprintf(intervalOut, "{\"interval\": %d, \"accesses\": %lld, \"instructions\": %lld, "
+                             "\"hits\": %d, \"misses\": %d, \"missRate\": %.6f, \"writebacks\": %d, ",
+                intervalsReported, accesses, retired, hits, misses,
+                hits + misses ? (double)misses / (hits + misses) : 0.0, writebacks);
+        if (retired)
+        {
+            fprintf(intervalOut, "\"mpki\": %.3f, ", 1000.0 * misses / retired);
+        }
+        else
+        {
+            fprintf(intervalOut, "\"mpki\": null, ");
+        }
+        fprintf(intervalOut, "\"dirtyBlocks\": %d}\n", c->dirtyBlocks);
+    }
+    intervalsReported++;
+    intervalStart.accesses = accessesDone;
+    intervalStart.instructions = instructions;
+    intervalStart.hits = c->hits;
+    intervalStart.misses = c->misses;
+    intervalStart.writebacks = c->writebacks;
+    nextInterval += intervalLength;
+}
+
+/*
+ * Have the statistics of every interval passed to hook as well, for
+ * library callers. Like the options, this is cleared by
+ * cache_clear_options and takes effect at cache_init.
+ */
+void cache_set_interval_hook(cacheIntervalHook hook)
+{
+    intervalHook = hook;
+}
+
+// Report the last, partial interval and close the interval file
+void cache_finish_intervals(void)
+{
+    if (!trackingIntervals)
+    {
+        return;
+    }
+    if (cache.accessClock > intervalStart.accesses || instructions > intervalStart.instructions)
+    {
+        report_interval(cache.accessClock);
+    }
+    if (intervalOut != NULL)
+    {
+        fclose(intervalOut);
+        intervalOut = NULL;
+    }
+    trackingIntervals = 0;
+}
+
+/*
+ * Tell the cache an instruction finished, for MPKI and
+ * interval-unit=instructions.
+ */
+void cache_instruction(void)
+{
+    instructions++;
+    if (trackingIntervals && intervalByInstructions && instructions >= nextInterval)
+    {
+        report_interval(cache.accessClock);
+    }
+}
+
+/*
+ * Access the cache. This is the main part of the project,
+ * and should call printAction as is appropriate.
+ * It should only call mem_access when absolutely necessary.
+ * addr is a 16-bit LC2K word address.
+ * write_flag is 0 for reads (fetch/lw) and 1 for writes (sw).
+ * write_data is a word, and is only valid if write_flag is 1.
+ * The return of mem_access is undefined if write_flag is 1.
+ * Thus the return of cache_access is undefined if write_flag is 1.
+ *
+ * With sampling enabled, accesses that are not simulated go straight to
+ * memory. That is only safe because an address always maps to the same
+ * set, and time sampling flushes the cache before bypassing it.
+ */
+int cache_access(int addr, int write_flag, int write_data)
+{
+    cacheStruct *c = &cache;
+    c->accessClock++;
+    c->lastFillCycles = 0;
+    if (trackingIntervals && !intervalByInstructions && c->accessClock > nextInterval)
+    {
+        report_interval(c->accessClock - 1);
+    }
+
+    if (sampleSets > 1 && get_set_index(c, addr) % sampleSets)
+    {
+        c->unsampledAccesses++;
+        return mem_access(addr, write_flag, write_data);
+    }
+    if (!sampleInterval)
+    {
+        int result = simulate_access(c, addr, write_flag, write_data);
+        if (compressing)
+        {
+            compress_access(get_set_index(c, addr), get_tag(c, addr),
+                            c->blocks[find_block(c, addr)].data, write_flag);
+        }
+        if (verifying && oracle_check(addr, write_flag, write_data, result,
+                                      c->lastHit, c->lastWay, c->lastWriteback))
+        {
+            printCache();
+            cache_error("verify found the cache diverging from the reference model");
+        }
+        return result;
+    }
+
+    // Time sampling: fast-forward, then warm up, then measure one unit
+    long long position = (c->accessClock - 1) % sampleInterval;
+    int warmupStart = sampleInterval - sampleUnit - sampleWarmup;
+    if (position < warmupStart)
+    {
+        if (position == 0)
+        {
+            flush_silently(c);
+        }
+        c->unsampledAccesses++;
+        return mem_access(addr, write_flag, write_data);
+    }
+    if (position < warmupStart + sampleWarmup)
+    {
+        c->unsampledAccesses++;
+        measuring = 0;
+        int result = simulate_access(c, addr, write_flag, write_data);
+        measuring = 1;
+        return result;
+    }
+    if (position == warmupStart + sampleWarmup)
+    {
+        c->unitHits = 0;
+        c->unitMisses = 0;
+    }
+    int result = simulate_access(c, addr, write_flag, write_data);
+    if (position == sampleInterval - 1)
+    {
+        add_sample(&c->units, c->unitHits + c->unitMisses, c->unitMisses);
+    }
+    return result;
+}
+
+/*
+ * Cycles the last cache_access took on a blocking cache: hit-latency, plus
+ * the memory latency of its fill if it missed. Accesses that bypass the
+ * cache under sampling count as hits.
+ */
+int cache_last_access_cycles(void)
+{
+    return hitLatency + cache.lastFillCycles;
+}
+
+// Move the MSHR clock to now, retiring every fill that completed by then
+static void advance_mshrs(long long now)
+{
+    while (mshrClock < now)
+    {
+        // The next event is the earliest completing fill, if it comes before now
+        int next = -1;
+        for (int m = 0; m < mshrsInUse; m++)
+        {
+            if (next == -1 || mshrs[m].readyAt < mshrs[next].readyAt)
+            {
+                next = m;
+            }
+        }
+        long long until = next != -1 && mshrs[next].readyAt < now ? mshrs[next].readyAt : now;
+        mshrOccupancy += mshrsInUse * (until - mshrClock);
+        if (mshrsInUse)
+        {
+            mshrBusyCycles += until - mshrClock;
+        }
+        mshrClock = until;
+        if (next != -1 && mshrs[next].readyAt <= mshrClock)
+        {
+            mshrs[next] = mshrs[--mshrsInUse];
+        }
+    }
+    // Fills completing exactly now free their MSHR too
+    for (int m = 0; m < mshrsInUse; m++)
+    {
+        if (mshrs[m].readyAt <= now)
+        {
+            mshrs[m--] = mshrs[--mshrsInUse];
+        }
+    }
+}
+
+/*
+ * cache_access with non-blocking cache timing. The access is issued at
+ * cycle *cycle, or later if every MSHR is busy, in which case *cycle is
+ * moved to when it actually issued. *ready is set to the cycle its data is
+ * available. A miss to a block (or sector) that is already being filled
+ * merges into that fill's MSHR instead of allocating another one, as long
+ * as the cache model still holds it. A miss to another sector of the block
+ * starts its own transfer, so it takes its own MSHR. Issue cycles must not
+ * go backwards between calls. Without MSHRs (mshrs=0) the cache blocks:
+ * the data is ready once the access and any fill are done.
+ */
+int cache_access_timed(int addr, int write_flag, int write_data, long long *cycle, long long *ready)
+{
+    if (numMshrs == 0)
+    {
+        int result = cache_access(addr, write_flag, write_data);
+        *ready = *cycle + hitLatency + cache.lastFillCycles;
+        return result;
+    }
+    int fillAddr = addr / (cache.blockSize / sectorsPerBlock);
+    advance_mshrs(*cycle);
+
+    for (int m = 0; m < mshrsInUse; m++)
+    {
+        if (mshrs[m].fillAddr == fillAddr && would_hit(&cache, addr))
+        {
+            // The cache model already holds the block; its data just isn't here yet
+            secondaryMisses++;
+            int result = cache_access(addr, write_flag, write_data);
+            *ready = *cycle + hitLatency > mshrs[m].readyAt ? *cycle + hitLatency : mshrs[m].readyAt;
+            return result;
+        }
+    }
+
+    if (!would_hit(&cache, addr) && mshrsInUse == numMshrs)
+    {
+        long long freeAt = mshrs[0].readyAt;
+        for (int m = 1; m < mshrsInUse; m++)
+        {
+            if (mshrs[m].readyAt < freeAt)
+            {
+                freeAt = mshrs[m].readyAt;
+            }
+        }
+        mshrFullCycles += freeAt - *cycle;
+        *cycle = freeAt;
+        advance_mshrs(*cycle);
+    }
+
+    int result = cache_access(addr, write_flag, write_data);
+    *ready = *cycle + hitLatency + cache.lastFillCycles;
+    // A miss takes an MSHR even if memory answers instantly
+    if (!cache.lastHit)
+    {
+        primaryMisses++;
+        mshrs[mshrsInUse].fillAddr = fillAddr;
+        mshrs[mshrsInUse].readyAt = *ready;
+        mshrsInUse++;
+    }
+    return result;
+}
+
+/*
+ * cache_access on count accesses in order, with the result of access i in
+ * results[i]. write_data may be NULL if there are no writes. This does
+ * exactly what count calls to cache_access would, but while it works on
+ * access i it prefetches the tags of the set access i + distance uses, so
+ * their cache misses on the host overlap with the simulation.
+ */
+void cache_access_batch(int count, const int *addrs, const int *write_flags, const int *write_data, int *results)
+{
+    cacheStruct *c = &cache;
+    int ways = c->blocksPerSet < BATCH_PREFETCH_WAYS ? c->blocksPerSet : BATCH_PREFETCH_WAYS;
+    for (int i = 0; i < count; i++)
+    {
+        if (i + BATCH_PREFETCH_DISTANCE < count)
+        {
+            int set_start = get_set_index(c, addrs[i + BATCH_PREFETCH_DISTANCE]) * c->blocksPerSet;
+            for (int way = 0; way < ways; way++)
+            {
+                int block = indexFunction == indexSkewed
+                                ? get_way_set_index(c, addrs[i + BATCH_PREFETCH_DISTANCE], way) * c->blocksPerSet + way
+                                : set_start + c->recency[set_start + way];
+                __builtin_prefetch(&c->blocks[block].tag);
+            }
+        }
+        results[i] = cache_access(addrs[i], write_flags[i], write_data ? write_data[i] : 0);
+    }
+}
+
+// MSHR statistics, after letting every outstanding fill complete
+static void print_mshr_stats(void)
+{
+    long long last = mshrClock;
+    for (int m = 0; m < mshrsInUse; m++)
+    {
+        if (mshrs[m].readyAt > last)
+        {
+            last = mshrs[m].readyAt;
+        }
+    }
+    advance_mshrs(last);
+    printf("mshrs: %d entries, %lld primary misses, %lld secondary misses merged, %lld cycles stalled on full MSHRs\n",
+           numMshrs, primaryMisses, secondaryMisses, mshrFullCycles);
+    printf("mshrs: average occupancy %.3f over %lld cycles, MLP %.3f\n",
+           mshrClock ? (double)mshrOccupancy / mshrClock : 0.0, mshrClock,
+           mshrBusyCycles ? (double)mshrOccupancy / mshrBusyCycles : 0.0);
+}
+
+// Run an access of tenant through its utility monitor
+static void umon_access(int tenant, int addr)
+{
+    int ways = cache.blocksPerSet;
+    int *stack = &umonTags[tenant][get_set_index(&cache, addr) * ways];
+    int tag = get_tag(&cache, addr);
+    int position = 0;
+    while (position < ways && stack[position] != tag)
+    {
+        position++;
+    }
+    if (position < ways)
+    {
+        umonHits[tenant][position]++;
+    }
+    else
+    {
+        position = ways - 1;
+    }
+    memmove(stack + 1, stack, position * sizeof(int));
+    stack[0] = tag;
+}
+
+/*
+ * Utility-based repartitioning with the lookahead algorithm: every tenant
+ * keeps one way, and the rest go, a few at a time, to whichever tenant
+ * gains the most hits per extra way. The monitors' counts are then halved
+ * so older behaviour fades out.
+ */
+static void ucp_repartition(void)
+{
+    int alloc[MAX_TENANTS];
+    int balance = cache.blocksPerSet - numTenants;
+    for (int t = 0; t < numTenants; t++)
+    {
+        alloc[t] = 1;
+    }
+    while (balance > 0)
+    {
+        double bestUtility = -1;
+        int bestTenant = 0;
+        int bestWays = 1;
+        for (int t = 0; t < numTenants; t++)
+        {
+            long long gained = 0;
+            for (int k = 1; k <= balance; k++)
+            {
+                gained += umonHits[t][alloc[t] + k - 1];
+                if ((double)gained / k > bestUtility)
+                {
+                    bestUtility = (double)gained / k;
+                    bestTenant = t;
+                    bestWays = k;
+                }
+            }
+        }
+        alloc[bestTenant] += bestWays;
+        balance -= bestWays;
+    }
+    set_way_masks(alloc);
+    for (int t = 0; t < numTenants; t++)
+    {
+        for (int way = 0; way < cache.blocksPerSet; way++)
+        {
+            umonHits[t][way] /= 2;
+        }
+    }
+    ucpRepartitions++;
+}
+
+/*
+ * cache_access on behalf of one of several programs sharing the cache.
+ * addr is the tenant's own word address; the cache sees it as
+ * tenant * 65536 + addr, which is also what printAction and mem_access get.
+ */
+int cache_access_tenant(int tenant, int addr, int write_flag, int write_data)
+{
+    if (tenant < 0 || tenant >= numTenants)
+    {
+        cache_error("tenant %d does not exist", tenant);
+    }
+    currentTenant = tenant;
+    addr += tenant * TENANT_SPACE;
+    if (partitionMode == partitionUtility)
+    {
+        umon_access(tenant, addr);
+        if (++ucpAccesses % ucpInterval == 0)
+        {
+            ucp_repartition();
+        }
+    }
+    return cache_access(addr, write_flag, write_data);
+}
+
+/*
+ * Tell the cache the pc of the instruction making the next accesses, for
+ * way-predict=pc. Without it every access looks like it came from pc 0.
+ */
+void cache_set_pc(int pc)
+{
+    accessPc = pc;
+}
+
+/*
+ * cache_access on behalf of one core of a multi-core run. Core 0 uses
+ * the global cache, so this is the same as cache_access for one core.
+ */
+int cache_access_core(int core, int addr, int write_flag, int write_data)
+{
+    if (core < 0 || core >= numCores)
+    {
+        cache_error("core %d does not exist", core);
+    }
+    if (core == 0)
+    {
+        return cache_access(addr, write_flag, write_data);
+    }
+    coreCaches[core]->accessClock++;
+    return simulate_access(coreCaches[core], addr, write_flag, write_data);
+}
+
+/*
+ * Parallel replay. An access only ever touches its own set, so hits, misses
+ * and victims of different sets are independent. Each worker thread owns a
+ * contiguous range of sets and simulates them in a private copy of the
+ * cache, fed through a lock-free single-producer single-consumer queue by
+ * the dispatching thread. Accesses carry their position in the stream so
+ * fill times and eviction ages match the serial run exactly.
+ */
+typedef struct replayEntry
+{
+    long long clock;
+    int addr;
+    int write_flag;
+} replayEntry;
+
+typedef struct replayWorker
+{
+    cacheStruct *c;
+    int firstSet;
+    int endSet;
+    replayEntry queue[REPLAY_QUEUE_SIZE];
+    // head is only written by the dispatcher, tail only by the worker
+    long long head;
+    long long tail;
+    int done;
+    pthread_t thread;
+} replayWorker;
+
+static void *replay_worker(void *arg)
+{
+    replayWorker *w = arg;
+    for (;;)
+    {
+        long long tail = w->tail;
+        if (tail == __atomic_load_n(&w->head, __ATOMIC_ACQUIRE))
+        {
+            // Only trust done once the queue is seen empty after it was set
+            if (__atomic_load_n(&w->done, __ATOMIC_ACQUIRE) &&
+                tail == __atomic_load_n(&w->head, __ATOMIC_ACQUIRE))
+            {
+                return NULL;
+            }
+            sched_yield();
+            continue;
+        }
+        replayEntry *e = &w->queue[tail % REPLAY_QUEUE_SIZE];
+        w->c->accessClock = e->clock;
+        simulate_access(w->c, e->addr, e->write_flag, 0);
+        __atomic_store_n(&w->tail, tail + 1, __ATOMIC_RELEASE);
+    }
+}
+
+static void replay_push(replayWorker *w, long long clock, int addr, int write_flag)
+{
+    while (w->head - __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE) == REPLAY_QUEUE_SIZE)
+    {
+        sched_yield();
+    }
+    replayEntry *e = &w->queue[w->head % REPLAY_QUEUE_SIZE];
+    e->clock = clock;
+    e->addr = addr;
+    e->write_flag = write_flag;
+    __atomic_store_n(&w->head, w->head + 1, __ATOMIC_RELEASE);
+}
+
+// Fold a worker's sets and statistics back into the global cache
+static void replay_merge(replayWorker *w)
+{
+    cacheStruct *c = w->c;
+    int first = w->firstSet * cache.blocksPerSet;
+    int end = w->endSet * cache.blocksPerSet;
+    memcpy(&cache.blocks[first], &c->blocks[first], (end - first) * sizeof(blockStruct));
+    for (int set = w->firstSet; set < w->endSet; set++)
+    {
+        cache.setAccesses[set] = c->setAccesses[set];
+        cache.setMisses[set] = c->setMisses[set];
+        cache.setEvictions[set] = c->setEvictions[set];
+        cache.setWritebacks[set] = c->setWritebacks[set];
+    }
+    memcpy(&cache.recency[first], &c->recency[first], end - first);
+    for (int b = 0; b < AGE_BUCKETS; b++)
+    {
+        cache.evictionAges[b] += c->evictionAges[b];
+    }
+    cache.hits += c->hits;
+    cache.misses += c->misses;
+    cache.writebacks += c->writebacks;
+    for (int t = 0; t < MAX_TENANTS; t++)
+    {
+        cache.tenants[t].hits += c->tenants[t].hits;
+        cache.tenants[t].misses += c->tenants[t].misses;
+        cache.tenants[t].writebacks += c->tenants[t].writebacks;
+        cache.tenants[t].evictedByOthers += c->tenants[t].evictedByOthers;
+    }
+    cache.wordsFilled += c->wordsFilled;
+    cache.wordsWrittenBack += c->wordsWrittenBack;
+    cache.wordsUsed += c->wordsUsed;
+    cache.sectorMisses += c->sectorMisses;
+    cache.probes += c->probes;
+    cache.wayOrderProbes += c->wayOrderProbes;
+    cache.firstProbeHits += c->firstProbeHits;
+    replayMemoryWords += c->wordsFilled + c->wordsWrittenBack;
+}
+
+static void replay_parallel(int (*next)(int *addr, int *write_flag, int *write_data))
+{
+    int threads = numThreads < cache.numSets ? numThreads : cache.numSets;
+    replayWorker *workers = calloc(threads, sizeof(replayWorker));
+    if (workers == NULL)
+    {
+        cache_error("out of memory for replay workers");
+    }
+    for (int t = 0; t < threads; t++)
+    {
+        replayWorker *w = &workers[t];
+        w->firstSet = t * cache.numSets / threads;
+        w->endSet = (t + 1) * cache.numSets / threads;
+        w->c = malloc(sizeof(cacheStruct));
+        if (w->c == NULL)
+        {
+            cache_error("out of memory for replay workers");
+        }
+        memcpy(w->c, &cache, sizeof(cacheStruct));
+        w->c->tagsOnly = 1;
+        w->c->hits = 0;
+        w->c->misses = 0;
+        w->c->writebacks = 0;
+        memset(w->c->tenants, 0, sizeof(w->c->tenants));
+        w->c->wordsFilled = 0;
+        w->c->wordsWrittenBack = 0;
+        w->c->wordsUsed = 0;
+        w->c->sectorMisses = 0;
+        w->c->probes = 0;
+        w->c->wayOrderProbes = 0;
+        w->c->firstProbeHits = 0;
+        memset(w->c->evictionAges, 0, sizeof(w->c->evictionAges));
+        if (pthread_create(&w->thread, NULL, replay_worker, w) != 0)
+        {
+            cache_error("can't start replay thread %d", t);
+        }
+    }
+
+    int owner[MAX_CACHE_SIZE];
+    for (int t = 0; t < threads; t++)
+    {
+        for (int set = workers[t].firstSet; set < workers[t].endSet; set++)
+        {
+            owner[set] = t;
+        }
+    }
+
+    int addr, write_flag, write_data;
+    while (next(&addr, &write_flag, &write_data))
+    {
+        replay_push(&workers[owner[get_set_index(&cache, addr)]], ++cache.accessClock, addr, write_flag);
+    }
+
+    for (int t = 0; t < threads; t++)
+    {
+        __atomic_store_n(&workers[t].done, 1, __ATOMIC_RELEASE);
+    }
+    for (int t = 0; t < threads; t++)
+    {
+        pthread_join(workers[t].thread, NULL);
+        replay_merge(&workers[t]);
+        free(workers[t].c);
+    }
+    free(workers);
+    recount_dirty_blocks(&cache);
+}
+
+/*
+ * Replay a stream of accesses through the cache, for trace-driven runs.
+ * next() stores the next access and returns 1, or returns 0 at the end of
+ * the stream. With one thread this is cache_access on every access, in
+ * batches through cache_access_batch. With
+ * threads > 1 the sets are simulated in parallel on tags and statistics
+ * only: the hits, misses, writebacks, per-set counters and final tags are
+ * the same as the serial run, but nothing is printed and the cached data
+ * is not kept up to date.
+ */
+void cache_replay(int (*next)(int *addr, int *write_flag, int *write_data))
+{
+    if (numThreads > 1)
+    {
+        replay_parallel(next);
+        return;
+    }
+    int addrs[REPLAY_BATCH_SIZE];
+    int write_flags[REPLAY_BATCH_SIZE];
+    int write_data[REPLAY_BATCH_SIZE];
+    int results[REPLAY_BATCH_SIZE];
+    int count;
+    do
+    {
+        for (count = 0; count < REPLAY_BATCH_SIZE &&
+                        next(&addrs[count], &write_flags[count], &write_data[count]);
+             count++)
+        {
+        }
+        cache_access_batch(count, addrs, write_flags, write_data, results);
+    } while (count == REPLAY_BATCH_SIZE);
+}
+
+/*
+ * Memory words accessed by the replays since cache_init that mem_access
+ * didn't see, because they ran on tags-only workers with threads > 1
+ */
+int cache_replay_memory_words(void)
+{
+    return (int)replayMemoryWords;
+}
+
+/*
+ * Checkpointing. The cache section of a checkpoint is the geometry, the
+ * statistics, every block's bookkeeping and the data of valid blocks only.
+ * It uses the host's int layout, so checkpoints are not portable between
+ * machines.
+ */
+static void write_checkpoint(const void *buf, size_t size, size_t count, FILE *out)
+{
+    if (fwrite(buf, size, count, out) != count)
+    {
+        cache_error("failed to write cache checkpoint");
+    }
+}
+
+static void read_checkpoint(void *buf, size_t size, size_t count, FILE *in)
+{
+    if (fread(buf, size, count, in) != count)
+    {
+        cache_error("truncated cache checkpoint");
+    }
+}
+
+/*
+ * Append the complete cache state to out, followed by the reference
+ * model's with verify=1 and the memory timing model's.
+ */
+void cache_checkpoint_save(FILE *out)
+{
+    cacheStruct *c = &cache;
+    if (compressing)
+    {
+        cache_error("checkpoints don't include the compression model");
+    }
+    int header[6] = {CHECKPOINT_MAGIC, CHECKPOINT_VERSION,
+                     c->blockSize, c->numSets, c->blocksPerSet, indexFunction};
+    int counters[5] = {c->hits, c->misses, c->writebacks,
+                       c->unitHits, c->unitMisses};
+    write_checkpoint(header, sizeof(int), 6, out);
+    write_checkpoint(counters, sizeof(int), 5, out);
+    write_checkpoint(&c->accessClock, sizeof(long long), 1, out);
+    write_checkpoint(&c->unsampledAccesses, sizeof(long long), 1, out);
+    write_checkpoint(&c->units, sizeof(sampleStruct), 1, out);
+    write_checkpoint(c->setAccesses, sizeof(long long), c->numSets, out);
+    write_checkpoint(c->setMisses, sizeof(long long), c->numSets, out);
+    write_checkpoint(c->setEvictions, sizeof(long long), c->numSets, out);
+    write_checkpoint(c->setWritebacks, sizeof(long long), c->numSets, out);
+    write_checkpoint(c->evictionAges, sizeof(long long), AGE_BUCKETS, out);
+    long long traffic[4] = {c->wordsFilled, c->wordsWrittenBack, c->wordsUsed, c->sectorMisses};
+    write_checkpoint(traffic, sizeof(long long), 4, out);
+    long long probes[4] = {c->probes, c->wayOrderProbes, c->firstProbeHits, c->relocations};
+    write_checkpoint(probes, sizeof(long long), 4, out);
+    write_checkpoint(&maintenanceStats, sizeof(maintenanceStruct), 1, out);
+    write_checkpoint(&instructions, sizeof(long long), 1, out);
+    write_checkpoint(c->wayTable, 1, sizeof(c->wayTable), out);
+    for (int i = 0; i < c->numSets * c->blocksPerSet; i++)
+    {
+        blockStruct *b = &c->blocks[i];
+        int fields[7] = {b->valid, b->dirty, b->lruLabel, b->tag,
+                         b->fills, b->totalHits, b->reuse};
+        unsigned int sectors[2] = {b->sectorValid, b->sectorDirty};
+        write_checkpoint(fields, sizeof(int), 7, out);
+        write_checkpoint(sectors, sizeof(unsigned int), 2, out);
+        write_checkpoint(b->touched, sizeof(b->touched), 1, out);
+        write_checkpoint(&b->fillTime, sizeof(long long), 1, out);
+        write_checkpoint(&b->lastUse, sizeof(long long), 1, out);
+        if (b->valid)
+        {
+            write_checkpoint(b->data, sizeof(int), c->blockSize, out);
+        }
+    }
+    write_checkpoint(&verifying, sizeof(int), 1, out);
+    if (verifying)
+    {
+        oracle_checkpoint_save(out);
+    }
+    memory_checkpoint_save(out);
+}
+
+/*
+ * Put the recency order of every set back together from the LRU labels:
+ * valid ways by label, then the invalid ones.
+ */
+static void rebuild_recency(cacheStruct *c)
+{
+    for (int set = 0; set < c->numSets; set++)
+    {
+        int set_start = set * c->blocksPerSet;
+        unsigned char *order = &c->recency[set_start];
+        for (int i = 0; i < c->blocksPerSet; i++)
+        {
+            // Insertion sort; sets are small
+            blockStruct *b = &c->blocks[set_start + i];
+            int j = i;
+            while (j > 0)
+            {
+                blockStruct *before = &c->blocks[set_start + order[j - 1]];
+                if (before->valid && (!b->valid || before->lruLabel <= b->lruLabel))
+                {
+                    break;
+                }
+                if (!before->valid && !b->valid)
+                {
+                    break;
+                }
+                order[j] = order[j - 1];
+                j--;
+            }
+            order[j] = i;
+        }
+    }
+}
+
+/*
+ * Replace the cache state with a checkpoint written by cache_checkpoint_save.
+ * cache_init must already have been called with the same geometry.
+ */
+void cache_checkpoint_load(FILE *in)
+{
+    cacheStruct *c = &cache;
+    int header[6];
+    int counters[5];
+    read_checkpoint(header, sizeof(int), 6, in);
+    if (header[0] != CHECKPOINT_MAGIC || header[1] != CHECKPOINT_VERSION)
+    {
+        cache_error("not a version %d cache checkpoint", CHECKPOINT_VERSION);
+    }
+    if (header[2] != c->blockSize || header[3] != c->numSets || header[4] != c->blocksPerSet ||
+        header[5] != (int)indexFunction)
+    {
+        cache_error("checkpoint is for a %d %d %d cache with another index function",
+                    header[2], header[3], header[4]);
+    }
+    read_checkpoint(counters, sizeof(int), 5, in);
+    c->hits = counters[0];
+    c->misses = counters[1];
+    c->writebacks = counters[2];
+    c->unitHits = counters[3];
+    c->unitMisses = counters[4];
+    read_checkpoint(&c->accessClock, sizeof(long long), 1, in);
+    read_checkpoint(&c->unsampledAccesses, sizeof(long long), 1, in);
+    read_checkpoint(&c->units, sizeof(sampleStruct), 1, in);
+    read_checkpoint(c->setAccesses, sizeof(long long), c->numSets, in);
+    read_checkpoint(c->setMisses, sizeof(long long), c->numSets, in);
+    read_checkpoint(c->setEvictions, sizeof(long long), c->numSets, in);
+    read_checkpoint(c->setWritebacks, sizeof(long long), c->numSets, in);
+    read_checkpoint(c->evictionAges, sizeof(long long), AGE_BUCKETS, in);
+    long long traffic[4];
+    read_checkpoint(traffic, sizeof(long long), 4, in);
+    c->wordsFilled = traffic[0];
+    c->wordsWrittenBack = traffic[1];
+    c->wordsUsed = traffic[2];
+    c->sectorMisses = traffic[3];
+    long long probes[4];
+    read_checkpoint(probes, sizeof(long long), 4, in);
+    c->probes = probes[0];
+    c->wayOrderProbes = probes[1];
+    c->firstProbeHits = probes[2];
+    c->relocations = probes[3];
+    read_checkpoint(&maintenanceStats, sizeof(maintenanceStruct), 1, in);
+    read_checkpoint(&instructions, sizeof(long long), 1, in);
+    read_checkpoint(c->wayTable, 1, sizeof(c->wayTable), in);
+    for (int i = 0; i < c->numSets * c->blocksPerSet; i++)
+    {
+        blockStruct *b = &c->blocks[i];
+        int fields[7];
+        unsigned int sectors[2];
+        read_checkpoint(fields, sizeof(int), 7, in);
+        read_checkpoint(sectors, sizeof(unsigned int), 2, in);
+        read_checkpoint(b->touched, sizeof(b->touched), 1, in);
+        b->sectorValid = sectors[0];
+        b->sectorDirty = sectors[1];
+        b->valid = fields[0];
+        b->dirty = fields[1];
+        b->lruLabel = fields[2];
+        b->tag = fields[3];
+        b->fills = fields[4];
+        b->totalHits = fields[5];
+        b->reuse = fields[6];
+        read_checkpoint(&b->fillTime, sizeof(long long), 1, in);
+        read_checkpoint(&b->lastUse, sizeof(long long), 1, in);
+        if (b->valid)
+        {
+            read_checkpoint(b->data, sizeof(int), c->blockSize, in);
+        }
+    }
+    rebuild_recency(c);
+    recount_dirty_blocks(c);
+    // A run without verify reads the reference model and ignores it, but a
+    // verified one can't start from a checkpoint that doesn't have it
+    int verified;
+    read_checkpoint(&verified, sizeof(int), 1, in);
+    if (verifying && !verified)
+    {
+        cache_error("verify needs a checkpoint saved with verify=1");
+    }
+    if (verified)
+    {
+        if (!verifying)
+        {
+            oracle_init(c->blockSize, c->numSets, c->blocksPerSet);
+        }
+        oracle_checkpoint_load(in);
+    }
+    memory_checkpoint_load(in);
+
+    // Intervals go on from the checkpoint, the first one starting here
+    long long done = intervalByInstructions ? instructions : c->accessClock;
+    intervalsReported = done / intervalLength;
+    nextInterval = (done / intervalLength + 1) * intervalLength;
+    intervalStart.accesses = c->accessClock;
+    intervalStart.instructions = instructions;
+    intervalStart.hits = c->hits;
+    intervalStart.misses = c->misses;
+    intervalStart.writebacks = c->writebacks;
+}
+
+// Last eviction-age bucket with a nonzero count, or -1 if nothing was evicted
+static int last_age_bucket(cacheStruct *c)
+{
+    int last = -1;
+    for (int b = 0; b < AGE_BUCKETS; b++)
+    {
+        if (c->evictionAges[b])
+        {
+            last = b;
+        }
+    }
+    return last;
+}
+
+static void dump_stats_csv(cacheStruct *c, FILE *out)
+{
+    fprintf(out, "# sets\n");
+    fprintf(out, "set,accesses,hits,misses,evictions,writebacks\n");
+    for (int set = 0; set < c->numSets; set++)
+    {
+        fprintf(out, "%d,%lld,%lld,%lld,%lld,%lld\n", set,
+                c->setAccesses[set], c->setAccesses[set] - c->setMisses[set],
+                c->setMisses[set], c->setEvictions[set], c->setWritebacks[set]);
+    }
+    fprintf(out, "\n# blocks\n");
+    fprintf(out, "set,way,valid,dirty,fills,hits,reuse\n");
+    for (int set = 0; set < c->numSets; set++)
+    {
+        for (int way = 0; way < c->blocksPerSet; way++)
+        {
+            blockStruct *b = &c->blocks[set * c->blocksPerSet + way];
+            fprintf(out, "%d,%d,%d,%d,%d,%d,%d\n", set, way, b->valid,
+                    b->valid && b->dirty, b->fills, b->totalHits, b->reuse);
+        }
+    }
+    fprintf(out, "\n# eviction ages\n");
+    fprintf(out, "min,max,count\n");
+    for (int b = 0; b <= last_age_bucket(c); b++)
+    {
+        fprintf(out, "%lld,%lld,%lld\n", 1LL << b, (2LL << b) - 1, c->evictionAges[b]);
+    }
+}
+
+static void dump_stats_json(cacheStruct *c, FILE *out)
+{
+    fprintf(out, "{\"blockSize\": %d, \"numSets\": %d, \"blocksPerSet\": %d,\n",
+            c->blockSize, c->numSets, c->blocksPerSet);
+    fprintf(out, " \"hits\": %d, \"misses\": %d, \"writebacks\": %d,\n",
+            c->hits, c->misses, c->writebacks);
+    fprintf(out, " \"sets\": [\n");
+    for (int set = 0; set < c->numSets; set++)
+    {
+        fprintf(out, "  {\"set\": %d, \"accesses\": %lld, \"misses\": %lld, "
+                     "\"evictions\": %lld, \"writebacks\": %lld, \"blocks\": [",
+                set, c->setAccesses[set], c->setMisses[set],
+                c->setEvictions[set], c->setWritebacks[set]);
+        for (int way = 0; way < c->blocksPerSet; way++)
+        {
+            blockStruct *b = &c->blocks[set * c->blocksPerSet + way];
+            fprintf(out, "%s{\"way\": %d, \"valid\": %d, \"dirty\": %d, \"fills\": %d, "
+                         "\"hits\": %d, \"reuse\": %d}",
+                    way ? ", " : "", way, b->valid, b->valid && b->dirty,
+                    b->fills, b->totalHits, b->reuse);
+        }
+        fprintf(out, "]}%s\n", set + 1 < c->numSets ? "," : "");
+    }
+    fprintf(out, " ],\n \"evictionAges\": [");
+    for (int b = 0; b <= last_age_bucket(c); b++)
+    {
+        fprintf(out, "%s{\"min\": %lld, \"max\": %lld, \"count\": %lld}",
+                b ? ", " : "", 1LL << b, (2LL << b) - 1, c->evictionAges[b]);
+    }
+    fprintf(out, "]}\n");
+}
+
+/*
+ * Write the per-set, per-block and eviction-age instrumentation to path.
+ * The format is JSON if path ends in .json, otherwise CSV with one
+ * "# name"-headed table per section.
+ */
+static void dump_stats(cacheStruct *c, const char *path)
+{
+    FILE *out = fopen(path, "w");
+    if (out == NULL)
+    {
+        cache_error("can't open stats file %s", path);
+    }
+    size_t len = strlen(path);
+    if (len >= 5 && !strcmp(path + len - 5, ".json"))
+    {
+        dump_stats_json(c, out);
+    }
+    else
+    {
+        dump_stats_csv(c, out);
+    }
+    fclose(out);
+}
+
+/*
+ * The stats file of one core in a multi-core run: the core number goes
+ * before the extension, so heat.json becomes heat.core1.json.
+ */
+static void core_stats_path(char *out, const char *path, int core)
+{
+    const char *dot = strrchr(path, '.');
+    if (dot == NULL || strchr(dot, '/') != NULL)
+    {
+        dot = path + strlen(path);
+    }
+    sprintf(out, "%.*s.core%d%s", (int)(dot - path), path, core, dot);
+}
+
+// Memory traffic in words against the words the processor used
+static void print_traffic_stats(cacheStruct *c)
+{
+    long long moved = c->wordsFilled + c->wordsWrittenBack;
+    printf("sectors: %d per block of %d words, %lld misses to a missing sector of a present block\n",
+           sectorsPerBlock, c->blockSize, c->sectorMisses);
+    printf("traffic: %lld words moved (%lld filled, %lld written back), %lld words used, %.4f used per word filled\n",
+           moved, c->wordsFilled, c->wordsWrittenBack, c->wordsUsed,
+           c->wordsFilled ? (double)c->wordsUsed / c->wordsFilled : 0.0);
+}
+
+// Tag probes per access with way prediction, against probing in way order
+static void print_way_prediction_stats(cacheStruct *c)
+{
+    static const char *names[] = {"none", "mru", "address", "pc"};
+    long long accesses = (long long)c->hits + c->misses;
+    long long tagMatches = c->hits + c->sectorMisses;
+    printf("way prediction: %s, %lld of %lld tag matches on the first probe (%.2f%%)\n",
+           names[wayPredictor], c->firstProbeHits, tagMatches,
+           tagMatches ? 100.0 * c->firstProbeHits / tagMatches : 0.0);
+    printf("way prediction: %.3f tag probes per access, %.3f probing in way order\n",
+           accesses ? (double)c->probes / accesses : 0.0,
+           accesses ? (double)c->wayOrderProbes / accesses : 0.0);
+}
+
+// How evenly the index function spread accesses and misses over the sets
+static void print_index_stats(cacheStruct *c)
+{
+    static const char *names[] = {"modulo", "xor", "prime", "skewed"};
+    int setsAccessed = 0;
+    long long busiest = 0;
+    for (int set = 0; set < c->numSets; set++)
+    {
+        setsAccessed += c->setAccesses[set] > 0;
+        busiest = c->setMisses[set] > busiest ? c->setMisses[set] : busiest;
+    }
+    printf("index function: %s", names[indexFunction]);
+    if (indexFunction == indexPrime)
+    {
+        printf(" (modulo %d)", indexModulus);
+    }
+    printf(", %d of %d sets accessed, %.2f%% of misses in the busiest set\n", setsAccessed, c->numSets,
+           c->misses ? 100.0 * busiest / c->misses : 0.0);
+    if (indexFunction == indexSkewed)
+    {
+        printf("index function: %d levels of relocation candidates, %lld blocks relocated\n",
+               zcacheLevels, c->relocations);
+    }
+}
+
+// Per-tenant hits, misses and interference of a shared-cache run
+static void print_tenant_stats(void)
+{
+    int held[MAX_TENANTS] = {0};
+    for (int i = 0; i < cache.numSets * cache.blocksPerSet; i++)
+    {
+        if (cache.blocks[i].valid)
+        {
+            held[cache.blocks[i].tenant]++;
+        }
+    }
+    for (int t = 0; t < numTenants; t++)
+    {
+        tenantStruct *stats = &cache.tenants[t];
+        printf("tenant %d: hits %lld, misses %lld, writebacks %lld, %lld blocks evicted by other tenants, %d blocks held",
+               t, stats->hits, stats->misses, stats->writebacks, stats->evictedByOthers, held[t]);
+        if (partitionMode != partitionNone)
+        {
+            printf(", way mask 0x%llx", wayMasks[t]);
+        }
+        printf("\n");
+    }
+    if (partitionMode == partitionUtility)
+    {
+        printf("ucp: repartitioned %d times, every %d accesses\n", ucpRepartitions, ucpInterval);
+    }
+}
+
+// Per-core hit/miss and coherence traffic of a multi-core run
+static void print_coherence_stats(void)
+{
+    int invalidations = 0;
+    int transfers = 0;
+    for (int core = 0; core < numCores; core++)
+    {
+        cacheStruct *c = coreCaches[core];
+        printf("core %d: hits %d, misses %d, writebacks %d\n",
+               core, c->hits, c->misses, c->writebacks);
+        printf("core %d: bus reads %d, read-exclusives %d, upgrades %d, "
+               "invalidations received %d, transfers supplied %d, snoop writebacks %d\n",
+               core, c->busReads, c->busReadExclusives, c->busUpgrades,
+               c->invalidationsReceived, c->transfersSupplied, c->snoopWritebacks);
+        invalidations += c->invalidationsReceived;
+        transfers += c->transfersSupplied;
+    }
+    printf("%s totals: %d invalidations, %d cache-to-cache transfers\n",
+           moesi ? "MOESI" : "MESI", invalidations, transfers);
+}
+
+/*
+ * Extrapolate the whole-run hit and miss counts from a sampled run.
+ * Set sampling treats every simulated set as one sample, time sampling
+ * treats every completed measurement unit as one.
+ */
+static void print_sampling_estimate(cacheStruct *c)
+{
+    sampleStruct sample = c->units;
+    double population;
+    double halfWidth;
+
+    if (sampleInterval)
+    {
+        // A partially measured last unit still counts as a sample
+        if (c->unitHits + c->unitMisses &&
+            (c->accessClock - 1) % sampleInterval != sampleInterval - 1 &&
+            (c->accessClock - 1) % sampleInterval >= sampleInterval - sampleUnit)
+        {
+            add_sample(&sample, c->unitHits + c->unitMisses, c->unitMisses);
+        }
+        population = (double)c->accessClock / sampleUnit;
+    }
+    else
+    {
+        memset(&sample, 0, sizeof(sample));
+        for (int set = 0; set < c->numSets; set += sampleSets)
+        {
+            add_sample(&sample, c->setAccesses[set], c->setMisses[set]);
+        }
+        population = c->numSets;
+    }
+
+    double rate = estimate_miss_rate(&sample, population, &halfWidth);
+    long long estimatedMisses = (long long)(rate * c->accessClock + 0.5);
+    printf("sampled %lld of %lld accesses in %lld samples\n",
+           c->accessClock - c->unsampledAccesses, c->accessClock, sample.n);
+    if (halfWidth < 0)
+    {
+        printf("estimated miss rate %.6f (too few samples for a confidence interval)\n", rate);
+    }
+    else
+    {
+        printf("estimated miss rate %.6f +/- %.6f (95%% confidence)\n", rate, halfWidth);
+    }
+    printf("estimated hits %lld, misses %lld\n",
+           c->accessClock - estimatedMisses, estimatedMisses);
+}
+
+// Dirty blocks still in the caches of every core
+static int count_dirty_blocks(void)
+{
+    int dirtyBlocks = 0;
+    for (int core = 0; core < numCores; core++)
+    {
+        dirtyBlocks += coreCaches[core]->dirtyBlocks;
+    }
+    return dirtyBlocks;
+}
+
+/*
+ * The end of run statistics of printStats as numbers, for library runs.
+ * With several cores these are core 0's.
+ */
+void cache_get_stats(int *hits, int *misses, int *writebacks, int *dirtyBlocks)
+{
+    *hits = cache.hits;
+    *misses = cache.misses;
+    *writebacks = cache.writebacks;
+    *dirtyBlocks = count_dirty_blocks();
+}
+
+/*
+ * Write every dirty block of every core back to memory and empty the
+ * caches, without logging or counting anything, so a harness can compare
+ * memory with what the program wrote.
+ */
+void cache_flush(void)
+{
+    for (int core = 0; core < numCores; core++)
+    {
+        flush_silently(coreCaches[core]);
+    }
+}
+
+/*
+ * Take the valid block c->blocks[block] out of the cache, and out of the
+ * compressed tag array if compression is on. Its way becomes the least
+ * recently used of the set and the blocks that were behind it move up
+ * one, so the set's valid blocks stay first in recency order.
+ */
+static void drop_block(cacheStruct *c, int block)
+{
+    if (compressing)
+    {
+        // Compression needs index-function=modulo, so the set is the block's
+        compress_invalidate(block / c->blocksPerSet, c->blocks[block].tag);
+    }
+    c->dirtyBlocks -= c->blocks[block].dirty;
+    c->blocks[block].valid = 0;
+    c->blocks[block].dirty = 0;
+    c->blocks[block].sectorDirty = 0;
+    c->blocks[block].lruLabel = 0;
+    if (indexFunction == indexSkewed)
+    {
+        return;
+    }
+    int set_start = block - block % c->blocksPerSet;
+    unsigned char *order = &c->recency[set_start];
+    int position = 0;
+    while (order[position] != block - set_start)
+    {
+        position++;
+    }
+    for (int i = position + 1; i < c->blocksPerSet; i++)
+    {
+        if (c->blocks[set_start + order[i]].valid)
+        {
+            c->blocks[set_start + order[i]].lruLabel--;
+        }
+    }
+    memmove(order + position, order + position + 1, c->blocksPerSet - position - 1);
+    order[c->blocksPerSet - 1] = block - set_start;
+}
+
+/*
+ * Flush, clean or invalidate the valid block c->blocks[block], counting
+ * what it did in stats. Flushing writes the block's dirty sectors back and
+ * drops it, cleaning writes them back and keeps it, and invalidating drops
+ * it with whatever it held. Returns the memory latency of the writeback.
+ */
+static int maintain_block(cacheStruct *c, int block, enum maintenance operation, maintenanceStruct *stats)
+{
+    blockStruct *b = &c->blocks[block];
+    int base_addr = get_block_addr(c, block);
+    int written_back = b->dirty && operation != maintainInvalidate;
+    int cycles = 0;
+    if (written_back)
+    {
+        long long words = c->wordsWrittenBack;
+        record_writeback(c, block / c->blocksPerSet, block);
+        cycles = transfer_sectors(c, block, base_addr, b->sectorDirty, cacheToMemory);
+        if (measuring)
+        {
+            stats->writebacks++;
+            stats->words += c->wordsWrittenBack - words;
+        }
+    }
+    if (verifying)
+    {
+        oracle_maintain(base_addr, operation != maintainClean, written_back);
+    }
+    if (operation == maintainClean)
+    {
+        c->dirtyBlocks -= b->dirty;
+        b->dirty = 0;
+        b->sectorDirty = 0;
+        if (b->coherence == coherenceModified || b->coherence == coherenceOwned)
+        {
+            b->coherence = b->coherence == coherenceModified ? coherenceExclusive : coherenceShared;
+        }
+        return cycles;
+    }
+    if (!written_back)
+    {
+        transfer_sectors(c, block, base_addr, b->sectorValid, cacheToNowhere);
+    }
+    if (measuring)
+    {
+        stats->invalidated++;
+        stats->discarded += b->dirty && !written_back;
+    }
+    drop_block(c, block);
+    return cycles;
+}
+
+// Stop on an operation that isn't an enum maintenance
+static void check_maintenance(int operation)
+{
+    if (operation < 0 || operation >= NUM_MAINTENANCE)
+    {
+        cache_error("cache maintenance operation %d does not exist", operation);
+    }
+}
+
+/*
+ * Cache maintenance for the cflush, cclean and cinval instructions: flush
+ * (write back and invalidate), clean (write back and keep) or invalidate
+ * (drop, losing dirty data) every block holding any of the words words
+ * from addr, in the cache of every core. operation is an enum maintenance.
+ * A short range probes the sets of its blocks like a lookup; one with
+ * more blocks than the cache has sets costs less as a single pass over the
+ * tag array. Returns the memory latency of the writebacks.
+ */
+int cache_maintain(int operation, int addr, int words)
+{
+    check_maintenance(operation);
+    if (measuring)
+    {
+        maintenanceStats.operations[operation]++;
+    }
+    int cycles = 0;
+    for (int core = 0; words > 0 && core < numCores; core++)
+    {
+        cacheStruct *c = coreCaches[core];
+        int first = addr / c->blockSize;
+        int last = (addr + words - 1) / c->blockSize;
+        if (last - first < c->numSets)
+        {
+            for (int block_addr = first; block_addr <= last; block_addr++)
+            {
+                int block = find_block(c, block_addr * c->blockSize);
+                if (block != -1)
+                {
+                    cycles += maintain_block(c, block, operation, &maintenanceStats);
+                }
+            }
+            continue;
+        }
+        for (int block = 0; block < c->numSets * c->blocksPerSet; block++)
+        {
+            int block_addr = get_block_addr(c, block) / c->blockSize;
+            if (c->blocks[block].valid && first <= block_addr && block_addr <= last)
+            {
+                cycles += maintain_block(c, block, operation, &maintenanceStats);
+            }
+        }
+    }
+    if (compressing && operation != maintainClean)
+    {
+        // The compressed tag array holds more lines than the cache, and
+        // drop_block only took out the ones the cache held too
+        for (int a = addr - addr % cache.blockSize; a < addr + words; a += cache.blockSize)
+        {
+            compress_invalidate(get_set_index(&cache, a), get_tag(&cache, a));
+        }
+    }
+    return cycles;
+}
+
+// Apply operation to every valid block of every core's cache
+static int maintain_all(int operation, maintenanceStruct *stats)
+{
+    int cycles = 0;
+    for (int core = 0; core < numCores; core++)
+    {
+        cacheStruct *c = coreCaches[core];
+        for (int block = 0; block < c->numSets * c->blocksPerSet; block++)
+        {
+            if (c->blocks[block].valid)
+            {
+                cycles += maintain_block(c, block, operation, stats);
+            }
+        }
+    }
+    if (compressing && operation != maintainClean)
+    {
+        compress_invalidate_all();
+    }
+    return cycles;
+}
+
+// cache_maintain for the whole of every core's cache
+int cache_maintain_all(int operation)
+{
+    check_maintenance(operation);
+    if (measuring)
+    {
+        maintenanceStats.operations[operation]++;
+    }
+    return maintain_all(operation, &maintenanceStats);
+}
+
+/*
+ * With final-flush=1, flush every core's cache, logging and counting the
+ * writebacks like any others, so the run's writebacks and memory accesses
+ * are its true total traffic and memory holds everything the program
+ * wrote. Call it when the program halts, before printStats; it only
+ * flushes once per cache_init.
+ */
+void cache_final_flush(void)
+{
+    if (!finalFlush || finalFlushed)
+    {
+        return;
+    }
+    finalFlushed = 1;
+    maintain_all(maintainFlush, &finalFlushStats);
+}
+
+static void print_maintenance_stats(void)
+{
+    const maintenanceStruct *m = &maintenanceStats;
+    if (m->operations[maintainFlush] || m->operations[maintainClean] || m->operations[maintainInvalidate])
+    {
+        printf("maintenance: %lld flushes, %lld cleans, %lld invalidates; %lld blocks (%lld words) written back, "
+               "%lld invalidated, %lld dirty blocks discarded\n",
+               m->operations[maintainFlush], m->operations[maintainClean], m->operations[maintainInvalidate],
+               m->writebacks, m->words, m->invalidated, m->discarded);
+    }
+    if (finalFlushed)
+    {
+        printf("final flush: %lld blocks (%lld words) written back, %lld blocks invalidated\n",
+               finalFlushStats.writebacks, finalFlushStats.words, finalFlushStats.invalidated);
+    }
+}
+
+// Whether the compression model's tag array holds the block at addr
+int cache_compressed_holds(int addr)
+{
+    return compressing && compress_holds(get_set_index(&cache, addr), get_tag(&cache, addr));
+}
+
+/*
+ * Check the bookkeeping of every core's cache. Returns 0 if it holds
+ * together, or -1 with what is wrong written to why:
+ *  -    every valid block is where a lookup of its address finds it, so no
+ *       set holds the same tag twice
+ *  -    only valid blocks are dirty, and only in sectors they hold
+ *  -    dirtyBlocks counts the dirty blocks
+ *  -    each set's recency order is a permutation of its ways
+ *  -    with one core (nothing invalidates blocks behind the cache's back)
+ *       and no skewing, the valid blocks of a set come first in recency
+ *       order, labelled 0, 1, 2, ...
+ */
+int cache_check_invariants(char *why, int size)
+{
+    for (int core = 0; core < numCores; core++)
+    {
+        cacheStruct *c = coreCaches[core];
+        int dirtyBlocks = 0;
+        for (int block = 0; block < c->numSets * c->blocksPerSet; block++)
+        {
+            blockStruct *b = &c->blocks[block];
+            if (b->valid && find_block(c, get_block_addr(c, block)) != block)
+            {
+                snprintf(why, size, "core %d: block %d (tag %d) isn't found at its address %d",
+                         core, block, b->tag, get_block_addr(c, block));
+                return -1;
+            }
+            if ((b->dirty && !b->valid) || (b->valid && !b->sectorValid) ||
+                (b->valid && (b->sectorDirty & ~b->sectorValid)) || (b->valid && b->dirty != !!b->sectorDirty))
+            {
+                snprintf(why, size, "core %d: block %d has valid %d, dirty %d, sectors valid %#x, dirty %#x",
+                         core, block, b->valid, b->dirty, b->sectorValid, b->sectorDirty);
+                return -1;
+            }
+            dirtyBlocks += b->valid && b->dirty;
+        }
+        if (dirtyBlocks != c->dirtyBlocks)
+        {
+            snprintf(why, size, "core %d: %d dirty blocks counted as %d", core, dirtyBlocks, c->dirtyBlocks);
+            return -1;
+        }
+
+        for (int set_index = 0; set_index < c->numSets; set_index++)
+        {
+            int set_start = set_index * c->blocksPerSet;
+            const unsigned char *order = &c->recency[set_start];
+            unsigned char seen[MAX_CACHE_SIZE] = {0};
+            int valid = 0;
+            for (int i = 0; i < c->blocksPerSet; i++)
+            {
+                int way = order[i];
+                if (way >= c->blocksPerSet || seen[way])
+                {
+                    snprintf(why, size, "core %d: set %d's recency order repeats or overruns way %d",
+                             core, set_index, way);
+                    return -1;
+                }
+                seen[way] = 1;
+                blockStruct *b = &c->blocks[set_start + way];
+                if (numCores > 1 || indexFunction == indexSkewed)
+                {
+                    continue;
+                }
+                if (b->valid && (valid != i || b->lruLabel != i))
+                {
+                    snprintf(why, size, "core %d: set %d's way %d is recency position %d with LRU label %d",
+                             core, set_index, way, i, b->lruLabel);
+                    return -1;
+                }
+                valid += b->valid;
+            }
+        }
+    }
+    return 0;
+}
+
+/*
+ * print end of run statistics like in the spec. **This is not required**,
  * but is very helpful in debugging.
  * This should be called once a halt is reached.
  * DO NOT delete this function, or else it won't compile.
@@ -277,19 +3384,66 @@ int cache_access(int addr, int write_flag, int write_data)
  */
 void printStats(void)
 {
+    cacheStruct *c = &cache;
     printf("End of run statistics:\n");
-    printf("hits %d, misses %d, writebacks %d\n",
-           cache.hits, cache.misses, cache.writebacks);
+    if (numCores == 1)
+    {
+        printf("hits %d, misses %d, writebacks %d\n",
+               c->hits, c->misses, c->writebacks);
+    }
+    else
+    {
+        print_coherence_stats();
+    }
 
-    int dirtyBlocks = 0;
-    for (int i = 0; i < cache.numSets * cache.blocksPerSet; i++)
+    printf("%d dirty cache blocks left\n", count_dirty_blocks());
+    print_maintenance_stats();
+    cache_finish_intervals();
+    memory_print_stats();
+    if (numMshrs)
     {
-        if (cache.blocks[i].valid && cache.blocks[i].dirty)
-        {
-            dirtyBlocks++;
-        }
+        print_mshr_stats();
+    }
+
+    if (numTenants > 1)
+    {
+        print_tenant_stats();
+    }
+    if (reportTraffic)
+    {
+        print_traffic_stats(c);
+    }
+    if (wayPredictor != predictNone)
+    {
+        print_way_prediction_stats(c);
+    }
+    if (indexFunction != indexModulo)
+    {
+        print_index_stats(c);
+    }
+    if (compressing)
+    {
+        compress_print_stats(c->hits);
+    }
+    if (verifying)
+    {
+        oracle_print_stats();
+    }
+    if (sampleSets > 1 || sampleInterval)
+    {
+        print_sampling_estimate(c);
+    }
+
+    if (statsFile[0] && numCores == 1)
+    {
+        dump_stats(c, statsFile);
+    }
+    for (int core = 0; statsFile[0] && numCores > 1 && core < numCores; core++)
+    {
+        char path[MAX_OPTION_LENGTH + 16];
+        core_stats_path(path, statsFile, core);
+        dump_stats(coreCaches[core], path);
     }
-    printf("%d dirty cache blocks left\n", dirtyBlocks);
 }
 
 /*
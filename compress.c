@@ -0,0 +1,352 @@
+/*
+ * Compressed cache model
+ * Estimates what compressing the data array of the cache would buy. A tag
+ * array running alongside the real cache (which stays uncompressed, so
+ * printAction and the statistics are unchanged) holds up to
+ * compression-tags times as many lines per set, as long as their
+ * compressed sizes fit in the set's data array. cache.c hands it every
+ * access with the line's current contents.
+ *  -    zero: only all-zero lines compress
+ *  -     bdi: base-delta-immediate, all-zero and repeated-value lines plus
+ *             a 4 byte base with 1 or 2 byte deltas from it or from zero
+ *  -     fpc: frequent pattern compression, a 3 bit prefix per word
+ *             selecting zero, small sign-extended, halfword or raw forms
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_CACHE_SIZE 256
+#define MAX_TAG_FACTOR 8
+#define MAX_OPTION_LENGTH 1000
+
+// Reports a bad option or configuration and stops, see cache.c
+extern void cache_error(const char *format, ...) __attribute__((noreturn));
+
+// How a line was stored, for the fill statistics
+enum encoding
+{
+    encodingZero,
+    encodingRepeated,
+    encodingDelta1,
+    encodingDelta2,
+    encodingPatterns,
+    encodingRaw,
+    NUM_ENCODINGS
+};
+
+static const char *encodingNames[NUM_ENCODINGS] = {
+    "zero", "repeated", "base+1-byte deltas", "base+2-byte deltas", "patterns", "uncompressed"};
+
+// A line in the compressed tag array
+typedef struct compressedLine
+{
+    int valid;
+    int tag;
+    int bytes;
+    long long lastUse;
+} compressedLine;
+
+static char algorithm[MAX_OPTION_LENGTH];
+static int tagFactor = 2;
+
+static int lineWords;
+static int numSets;
+static int linesPerSet;
+static int setCapacity;
+static compressedLine lines[MAX_CACHE_SIZE * MAX_TAG_FACTOR];
+static int setBytes[MAX_CACHE_SIZE];
+static int residentLines;
+
+static long long accesses;
+static long long hits;
+static long long fills;
+static long long fillBytes;
+static long long fillsByEncoding[NUM_ENCODINGS];
+// Sum over accesses of the lines resident afterwards
+static long long residentSum;
+
+// Bits FPC stores one word in, including its 3 bit prefix
+static int pattern_bits(unsigned int v)
+{
+    unsigned int high = v >> 16;
+    unsigned int low = v & 0xFFFFu;
+    int halvesAreBytes = ((high + 0x80u) & 0xFFFFu) < 0x100u && ((low + 0x80u) & 0xFFFFu) < 0x100u;
+    int repeatedBytes = v == (v & 0xFFu) * 0x01010101u;
+    int payload = 32;
+    payload = low == 0 || halvesAreBytes ? 16 : payload;
+    payload = v + 0x8000u < 0x10000u ? 16 : payload;
+    payload = repeatedBytes || v + 0x80u < 0x100u ? 8 : payload;
+    payload = v + 0x8u < 0x10u ? 4 : payload;
+    payload = v == 0 ? 0 : payload;
+    return 3 + payload;
+}
+
+/*
+ * One pass over the line collects what every encoding needs, with
+ * branch-free reductions the compiler can vectorize. Returns the size in
+ * bytes under the selected algorithm and its encoding in *encoding.
+ */
+static int compressed_size(const int *data, enum encoding *encoding)
+{
+    unsigned int base = (unsigned int)data[0];
+    unsigned int any = 0;
+    unsigned int differs = 0;
+    int delta1 = 1;
+    int delta2 = 1;
+    int patternBits = 0;
+    for (int i = 0; i < lineWords; i++)
+    {
+        unsigned int v = (unsigned int)data[i];
+        unsigned int d = v - base;
+        any |= v;
+        differs |= v ^ base;
+        delta1 &= (d + 0x80u < 0x100u) | (v + 0x80u < 0x100u);
+        delta2 &= (d + 0x8000u < 0x10000u) | (v + 0x8000u < 0x10000u);
+        patternBits += pattern_bits(v);
+    }
+
+    int raw = lineWords * 4;
+    int size = raw;
+    *encoding = encodingRaw;
+    if (!any)
+    {
+        *encoding = encodingZero;
+        return 1;
+    }
+    if (!strcmp(algorithm, "bdi"))
+    {
+        int mask = (lineWords + 7) / 8;
+        if (!differs)
+        {
+            *encoding = encodingRepeated;
+            size = 4;
+        }
+        else if (delta1)
+        {
+            *encoding = encodingDelta1;
+            size = 4 + lineWords + mask;
+        }
+        else if (delta2)
+        {
+            *encoding = encodingDelta2;
+            size = 4 + 2 * lineWords + mask;
+        }
+    }
+    else if (!strcmp(algorithm, "fpc"))
+    {
+        *encoding = encodingPatterns;
+        size = (patternBits + 7) / 8;
+    }
+    if (size >= raw)
+    {
+        *encoding = encodingRaw;
+        size = raw;
+    }
+    return size;
+}
+
+/*
+ * Set an option of the compression model. Returns 0 if the option was
+ * recognized, -1 otherwise.
+ *  -    compression=zero|bdi|fpc: turn the model on with this algorithm
+ *  -    compression-tags=<k>: tags per way of data array (default 2)
+ */
+int compress_set_option(const char *name, const char *value)
+{
+    if (!strcmp(name, "compression"))
+    {
+        if (strcmp(value, "zero") && strcmp(value, "bdi") && strcmp(value, "fpc"))
+        {
+            cache_error("compression must be zero, bdi or fpc");
+        }
+        strcpy(algorithm, value);
+        return 0;
+    }
+    if (!strcmp(name, "compression-tags"))
+    {
+        tagFactor = atoi(value);
+        return 0;
+    }
+    return -1;
+}
+
+// Turn compression off and restore the default settings
+void compress_clear_options(void)
+{
+    algorithm[0] = '\0';
+    tagFactor = 2;
+}
+
+// Check the settings and empty the model; returns 1 if compression is on
+int compress_init(int blockSize, int sets, int blocksPerSet)
+{
+    if (!algorithm[0])
+    {
+        return 0;
+    }
+    if (tagFactor < 1 || tagFactor > MAX_TAG_FACTOR)
+    {
+        cache_error("compression-tags must be between 1 and %d", MAX_TAG_FACTOR);
+    }
+    lineWords = blockSize;
+    numSets = sets;
+    linesPerSet = blocksPerSet * tagFactor;
+    setCapacity = blocksPerSet * blockSize * 4;
+    memset(lines, 0, sizeof(lines));
+    memset(setBytes, 0, sizeof(setBytes));
+    residentLines = 0;
+    accesses = 0;
+    hits = 0;
+    fills = 0;
+    fillBytes = 0;
+    memset(fillsByEncoding, 0, sizeof(fillsByEncoding));
+    residentSum = 0;
+    return 1;
+}
+
+static void evict(int set, compressedLine *line)
+{
+    line->valid = 0;
+    setBytes[set] -= line->bytes;
+    residentLines--;
+}
+
+// Evict least recently used lines other than keep until extra bytes and a line fit
+static void make_room(int set, const compressedLine *keep, int extra, int needTag)
+{
+    compressedLine *first = &lines[set * linesPerSet];
+    for (;;)
+    {
+        int used = 0;
+        compressedLine *lru = NULL;
+        for (int i = 0; i < linesPerSet; i++)
+        {
+            compressedLine *line = &first[i];
+            if (line->valid)
+            {
+                used++;
+                if (line != keep && (lru == NULL || line->lastUse < lru->lastUse))
+                {
+                    lru = line;
+                }
+            }
+        }
+        if (setBytes[set] + extra <= setCapacity && (!needTag || used < linesPerSet))
+        {
+            return;
+        }
+        evict(set, lru);
+    }
+}
+
+/*
+ * Run one access through the compressed tag array. data is the line's
+ * contents after the access, so a write recompresses it.
+ */
+void compress_access(int set, int tag, const int *data, int write_flag)
+{
+    compressedLine *first = &lines[set * linesPerSet];
+    compressedLine *line = NULL;
+    enum encoding encoding;
+    accesses++;
+    for (int i = 0; i < linesPerSet; i++)
+    {
+        if (first[i].valid && first[i].tag == tag)
+        {
+            line = &first[i];
+        }
+    }
+
+    if (line != NULL)
+    {
+        hits++;
+        if (write_flag)
+        {
+            // The line may no longer compress as well and push others out
+            int bytes = compressed_size(data, &encoding);
+            setBytes[set] += bytes - line->bytes;
+            line->bytes = bytes;
+            make_room(set, line, 0, 0);
+        }
+    }
+    else
+    {
+        int bytes = compressed_size(data, &encoding);
+        fills++;
+        fillBytes += bytes;
+        fillsByEncoding[encoding]++;
+        make_room(set, NULL, bytes, 1);
+        for (line = first; line->valid; line++)
+        {
+        }
+        line->valid = 1;
+        line->tag = tag;
+        line->bytes = bytes;
+        setBytes[set] += bytes;
+        residentLines++;
+    }
+    line->lastUse = accesses;
+    residentSum += residentLines;
+}
+
+// Drop the line the real cache flushed or invalidated, if the tag array holds it
+void compress_invalidate(int set, int tag)
+{
+    compressedLine *first = &lines[set * linesPerSet];
+    for (int i = 0; i < linesPerSet; i++)
+    {
+        if (first[i].valid && first[i].tag == tag)
+        {
+            evict(set, &first[i]);
+        }
+    }
+}
+
+// Drop every line, for a flush or invalidate of the whole cache
+void compress_invalidate_all(void)
+{
+    for (int set = 0; set < numSets; set++)
+    {
+        for (int i = 0; i < linesPerSet; i++)
+        {
+            if (lines[set * linesPerSet + i].valid)
+            {
+                evict(set, &lines[set * linesPerSet + i]);
+            }
+        }
+    }
+}
+
+// Whether the tag array holds the line, for the fuzzer's checks
+int compress_holds(int set, int tag)
+{
+    compressedLine *first = &lines[set * linesPerSet];
+    for (int i = 0; i < linesPerSet; i++)
+    {
+        if (first[i].valid && first[i].tag == tag)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Report how much compression gained over realHits, the uncompressed cache's hits
+void compress_print_stats(long long realHits)
+{
+    int physicalLines = numSets * setCapacity / (lineWords * 4);
+    printf("compression: %s with %d tags per way, %lld lines filled, average %.2f of %d bytes (%.2fx)\n",
+           algorithm, tagFactor, fills, fills ? (double)fillBytes / fills : 0.0, lineWords * 4,
+           fillBytes ? (double)fills * lineWords * 4 / fillBytes : 1.0);
+    printf("compression: fills by encoding:");
+    for (int e = 0; e < NUM_ENCODINGS; e++)
+    {
+        printf("%s %s %lld", e ? "," : "", encodingNames[e], fillsByEncoding[e]);
+    }
+    printf("\n");
+    printf("compression: effective capacity %.3fx (%.2f lines resident on average in %d), hits %lld, %+lld over uncompressed\n",
+           accesses ? (double)residentSum / accesses / physicalLines : 0.0,
+           accesses ? (double)residentSum / accesses : 0.0, physicalLines, hits, hits - realHits);
+}
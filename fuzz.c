@@ -0,0 +1,499 @@
+/*
+ * Property-based fuzzer for the cache model
+ * Runs random access streams through random cache configurations and
+ * checks cache.c against a flat memory:
+ *  -    every read returns the last value written to the word
+ *  -    after cache_flush, memory holds exactly what was written, so every
+ *       dirty word was written back, to the right address
+ *  -    cache_check_invariants holds every few accesses and at the end: no
+ *       set holds a tag twice, recency orders and LRU labels are
+ *       permutations, and the dirty block count is right
+ * Some cases mix in flushes, cleans and invalidates of random ranges or
+ * the whole cache. Invalidating loses dirty data, so the words of the
+ * blocks it covers must read as memory held them, and neither it nor a
+ * flush may leave the blocks in the compression model's tag array.
+ * Geometries cover everything cache_init accepts with power of 2 block
+ * sizes and sets, and options are drawn from sectors, index functions,
+ * ZCache, way prediction, sampling, cores, tenants with partitioning,
+ * compression and verify.
+ *
+ * Standalone it draws cases from a seeded generator:
+ *     ./fuzz [seed] [cases]
+ * and stops with the failing case's configuration at the first mismatch.
+ * Built with -DUSE_LIBFUZZER (make fuzz-libfuzzer) the same cases are
+ * decoded from libFuzzer's inputs instead, so it can steer towards new
+ * coverage.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MEMORYSIZE 65536 /* maximum number of words in memory */
+#define MAX_CACHE_SIZE 256
+#define MAX_BLOCK_SIZE 256
+#define MAX_TENANTS 8
+// Tenant t's word a is at t * TENANT_SPACE + a, see cache_access_tenant
+#define TENANT_SPACE 65536
+#define MAX_OPTIONS 16
+#define MAX_OPTION_LENGTH 200
+#define MAX_ACCESSES 4096
+#define MAX_WHY 1000
+
+extern void cache_init(int blockSize, int numSets, int blocksPerSet);
+extern int cache_access(int addr, int write_flag, int write_data);
+extern int cache_access_core(int core, int addr, int write_flag, int write_data);
+extern int cache_access_tenant(int tenant, int addr, int write_flag, int write_data);
+extern int cache_set_option(const char *name, const char *value);
+extern void cache_clear_options(void);
+extern void cache_set_pc(int pc);
+extern void cache_flush(void);
+extern int cache_check_invariants(char *why, int size);
+extern int cache_maintain(int operation, int addr, int words);
+extern int cache_maintain_all(int operation);
+extern int cache_compressed_holds(int addr);
+
+// Backing memory for the cache and the flat memory it must behave like
+static int mem[MAX_TENANTS * TENANT_SPACE];
+static int shadow[MAX_TENANTS * TENANT_SPACE];
+static int num_mem_accesses = 0;
+
+// Where the bytes deciding each case come from: libFuzzer's input, which
+// reads as zeros once used up, or the generator
+static const uint8_t *input;
+static size_t inputLeft;
+static int fromInput;
+static unsigned long long rngState;
+
+// The case being run, for the failure report
+typedef struct fuzzCase
+{
+    long long number;
+    int blockSize;
+    int numSets;
+    int blocksPerSet;
+    int numOptions;
+    char options[MAX_OPTIONS][2][MAX_OPTION_LENGTH];
+    int cores;
+    int tenants;
+    // Tenant addresses are below span
+    int span;
+    int accesses;
+    // Chance in percent of a maintenance operation before each access
+    int maintainPercent;
+} fuzzCase;
+
+static fuzzCase current;
+static long long totalAccesses = 0;
+
+int mem_access(int addr, int write_flag, int write_data)
+{
+    ++num_mem_accesses;
+    if (write_flag)
+    {
+        mem[addr] = write_data;
+    }
+    return mem[addr];
+}
+
+int get_num_mem_accesses(void)
+{
+    return num_mem_accesses;
+}
+
+static unsigned int next_bits(void)
+{
+    if (fromInput)
+    {
+        unsigned int bits = 0;
+        for (int i = 0; i < 4; i++)
+        {
+            bits = bits << 8 | (inputLeft ? (inputLeft--, *input++) : 0);
+        }
+        return bits;
+    }
+    // xorshift64*
+    rngState ^= rngState >> 12;
+    rngState ^= rngState << 25;
+    rngState ^= rngState >> 27;
+    return (unsigned int)(rngState * 2685821657736338717ULL >> 32);
+}
+
+// A number in [0, n)
+static int choose(int n)
+{
+    return n <= 1 ? 0 : (int)(next_bits() % (unsigned int)n);
+}
+
+// A power of 2 in [1, max]
+static int choose_power_of_2(int max)
+{
+    int bits = 0;
+    while ((2 << bits) <= max)
+    {
+        bits++;
+    }
+    return 1 << choose(bits + 1);
+}
+
+static void fail(const char *what)
+{
+    printf("fuzz: case %lld failed after %d accesses: %s\n", current.number, current.accesses, what);
+    printf("fuzz: cache %d %d %d", current.blockSize, current.numSets, current.blocksPerSet);
+    for (int i = 0; i < current.numOptions; i++)
+    {
+        printf(" %s=%s", current.options[i][0], current.options[i][1]);
+    }
+    printf(", addresses below %d, maintenance before %d%% of accesses\n", current.span, current.maintainPercent);
+    fflush(stdout);
+    abort();
+}
+
+static void add_option(const char *name, int value)
+{
+    snprintf(current.options[current.numOptions][0], MAX_OPTION_LENGTH, "%s", name);
+    snprintf(current.options[current.numOptions][1], MAX_OPTION_LENGTH, "%d", value);
+    current.numOptions++;
+}
+
+static void add_text_option(const char *name, const char *value)
+{
+    snprintf(current.options[current.numOptions][0], MAX_OPTION_LENGTH, "%s", name);
+    snprintf(current.options[current.numOptions][1], MAX_OPTION_LENGTH, "%s", value);
+    current.numOptions++;
+}
+
+// Pick a geometry and a combination of options cache_init accepts
+static void choose_configuration(void)
+{
+    current.numOptions = 0;
+    current.cores = 1;
+    current.tenants = 1;
+    current.blockSize = choose_power_of_2(choose(4) ? 16 : MAX_BLOCK_SIZE);
+    current.numSets = choose_power_of_2(MAX_CACHE_SIZE);
+    current.blocksPerSet = choose_power_of_2(MAX_CACHE_SIZE / current.numSets);
+    int bs = current.blockSize;
+    int ns = current.numSets;
+    int bps = current.blocksPerSet;
+
+    static const char *indexFunctions[] = {"modulo", "xor", "prime", "skewed"};
+    int index = choose(2) ? 0 : choose(4);
+    if (index == 3 && bps > 16)
+    {
+        index = 0;
+    }
+    add_text_option("index-function", indexFunctions[index]);
+    if (index == 3)
+    {
+        add_option("zcache-levels", 1 + choose(3));
+    }
+    else if (choose(3) == 0)
+    {
+        static const char *predictors[] = {"mru", "address", "pc"};
+        add_text_option("way-predict", predictors[choose(3)]);
+        add_option("way-table", 1 + choose(4096));
+    }
+
+    // At most one of the features that rule each other out
+    int sectored = 0;
+    switch (choose(7))
+    {
+    case 0:
+        current.cores = 2 + choose(3);
+        add_option("cores", current.cores);
+        add_text_option("coherence", choose(2) ? "moesi" : "mesi");
+        break;
+    case 1:
+        if (index == 0 && bps >= 2)
+        {
+            current.tenants = 2 + choose(bps < MAX_TENANTS - 1 ? bps - 1 : MAX_TENANTS - 1);
+            add_option("tenants", current.tenants);
+            int partition = bps <= 64 && bps >= current.tenants ? choose(3) : 0;
+            add_text_option("partition", partition == 2 ? "ucp" : partition ? "static" : "none");
+            add_option("ucp-interval", 1 + choose(200));
+            if (partition == 1)
+            {
+                // A random nonzero mask of the ways for every tenant
+                char masks[MAX_OPTION_LENGTH] = "";
+                unsigned long long allWays = bps == 64 ? ~0ULL : (1ULL << bps) - 1;
+                for (int t = 0; t < current.tenants; t++)
+                {
+                    unsigned long long mask = ((unsigned long long)next_bits() << 32 | next_bits()) & allWays;
+                    size_t used = strlen(masks);
+                    snprintf(masks + used, MAX_OPTION_LENGTH - used, "%s%llx", t ? "," : "",
+                             mask ? mask : 1ULL << choose(bps));
+                }
+                add_text_option("way-masks", masks);
+            }
+        }
+        break;
+    case 2:
+        sectored = choose_power_of_2(bs < 32 ? bs : 32);
+        add_option("sectors", sectored);
+        break;
+    case 3:
+        add_option("sample-sets", choose_power_of_2(ns));
+        break;
+    case 4:
+    {
+        int interval = 1 + choose(300);
+        int unit = 1 + choose(interval);
+        add_option("sample-interval", interval);
+        add_option("sample-unit", unit);
+        add_option("sample-warmup", choose(interval - unit + 1));
+        break;
+    }
+    case 5:
+        if (index == 0)
+        {
+            static const char *algorithms[] = {"zero", "bdi", "fpc"};
+            add_text_option("compression", algorithms[choose(3)]);
+            add_option("compression-tags", 1 + choose(8));
+        }
+        break;
+    default:
+        break;
+    }
+    if (index == 0 && current.cores == 1 && current.tenants == 1 && !sectored &&
+        current.numOptions < MAX_OPTIONS && choose(2))
+    {
+        // Sampling is the only option left that verify can't be combined with
+        int sampling = 0;
+        for (int i = 0; i < current.numOptions; i++)
+        {
+            sampling |= !strncmp(current.options[i][0], "sample", 6);
+        }
+        if (!sampling)
+        {
+            add_option("verify", 1);
+        }
+    }
+    // Small spans keep blocks coming back; large ones spread over memory
+    current.span = choose(2) ? bs * ns * bps * (1 + choose(4)) : MEMORYSIZE;
+    if (current.span > MEMORYSIZE)
+    {
+        current.span = MEMORYSIZE;
+    }
+
+    cache_clear_options();
+    cache_set_option("quiet", "1");
+    for (int i = 0; i < current.numOptions; i++)
+    {
+        if (cache_set_option(current.options[i][0], current.options[i][1]) != 0)
+        {
+            fail("option not recognized");
+        }
+    }
+    cache_init(bs, ns, bps);
+}
+
+static void check_invariants(void)
+{
+    char why[MAX_WHY];
+    if (cache_check_invariants(why, MAX_WHY) != 0)
+    {
+        fail(why);
+    }
+}
+
+// Fail if operation was an invalidate and memory was touched since accessesBefore
+static void check_untouched(int operation, int accessesBefore)
+{
+    if (operation == 2 && num_mem_accesses != accessesBefore)
+    {
+        fail("an invalidate wrote to memory");
+    }
+}
+
+// Fail if a flush or invalidate left a block of words [first, end) in the compression model
+static void check_dropped(int operation, int first, int end)
+{
+    for (int addr = first; operation != 1 && addr < end; addr += current.blockSize)
+    {
+        if (cache_compressed_holds(addr))
+        {
+            fail("the compression model kept a block the cache dropped");
+        }
+    }
+}
+
+/*
+ * Flush, clean or invalidate a random range of one tenant's words, or
+ * every cache. An invalidate must not touch memory, and afterwards the
+ * words of every block it covered hold what memory does, whether or not
+ * the block was dirty.
+ */
+static void maintain(void)
+{
+    int operation = choose(3);
+    int blockSize = current.blockSize;
+    int accessesBefore = num_mem_accesses;
+    if (choose(8) == 0)
+    {
+        cache_maintain_all(operation);
+        check_untouched(operation, accessesBefore);
+        for (int t = 0; t < current.tenants; t++)
+        {
+            check_dropped(operation, t * TENANT_SPACE, t * TENANT_SPACE + current.span);
+        }
+        for (int t = 0; operation == 2 && t < current.tenants; t++)
+        {
+            memcpy(&shadow[t * TENANT_SPACE], &mem[t * TENANT_SPACE], current.span * sizeof(int));
+        }
+        return;
+    }
+    int start = choose(current.span);
+    int words = 1 + choose(choose(2) ? 4 * blockSize : current.span - start);
+    words = words < current.span - start ? words : current.span - start;
+    int base = choose(current.tenants) * TENANT_SPACE;
+    cache_maintain(operation, base + start, words);
+    check_untouched(operation, accessesBefore);
+    int first = start - start % blockSize;
+    int end = (start + words + blockSize - 1) / blockSize * blockSize;
+    check_dropped(operation, base + first, base + end);
+    if (operation == 2)
+    {
+        memcpy(&shadow[base + first], &mem[base + first], (end - first) * sizeof(int));
+    }
+}
+
+/*
+ * Run one case: a stream of runs of sequential, strided, hot-set and
+ * random accesses, with reads checked as they happen and memory checked
+ * after the final flush.
+ */
+static void run_case(int maxAccesses)
+{
+    choose_configuration();
+    int span = current.span;
+    for (int t = 0; t < current.tenants; t++)
+    {
+        memset(&mem[t * TENANT_SPACE], 0, span * sizeof(int));
+        memset(&shadow[t * TENANT_SPACE], 0, span * sizeof(int));
+    }
+    int checkEvery = choose_power_of_2(256);
+    int writePercent = choose(101);
+    current.maintainPercent = choose(2) ? choose(6) : 0;
+    int hot[8];
+    for (int i = 0; i < 8; i++)
+    {
+        hot[i] = choose(span);
+    }
+
+    int addr = choose(span);
+    int mode = 0;
+    int stride = 1;
+    int runLeft = 0;
+    for (current.accesses = 0; current.accesses < maxAccesses; current.accesses++)
+    {
+        if (runLeft-- <= 0)
+        {
+            mode = choose(4);
+            runLeft = 1 + choose(64);
+            stride = 1 + choose(current.blockSize * current.numSets + 1);
+        }
+        switch (mode)
+        {
+        case 0:
+            addr = (addr + 1) % span;
+            break;
+        case 1:
+            addr = (addr + stride) % span;
+            break;
+        case 2:
+            addr = hot[choose(8)];
+            break;
+        default:
+            addr = choose(span);
+            break;
+        }
+        if (choose(100) < current.maintainPercent)
+        {
+            maintain();
+        }
+        int write_flag = choose(100) < writePercent;
+        int write_data = (int)next_bits();
+        int core = choose(current.cores);
+        int tenant = choose(current.tenants);
+        int word = tenant * TENANT_SPACE + addr;
+        int result;
+        cache_set_pc(choose(64));
+        if (current.tenants > 1)
+        {
+            result = cache_access_tenant(tenant, addr, write_flag, write_data);
+        }
+        else if (current.cores > 1)
+        {
+            result = cache_access_core(core, addr, write_flag, write_data);
+        }
+        else
+        {
+            result = cache_access(addr, write_flag, write_data);
+        }
+        if (write_flag)
+        {
+            shadow[word] = write_data;
+        }
+        else if (result != shadow[word])
+        {
+            char why[MAX_WHY];
+            snprintf(why, MAX_WHY, "core %d read %d from tenant %d's word %d, last written %d",
+                     core, result, tenant, addr, shadow[word]);
+            fail(why);
+        }
+        if ((current.accesses + 1) % checkEvery == 0)
+        {
+            check_invariants();
+        }
+    }
+    check_invariants();
+    totalAccesses += current.accesses;
+
+    cache_flush();
+    check_invariants();
+    for (int t = 0; t < current.tenants; t++)
+    {
+        for (int a = 0; a < span; a++)
+        {
+            if (mem[t * TENANT_SPACE + a] != shadow[t * TENANT_SPACE + a])
+            {
+                char why[MAX_WHY];
+                snprintf(why, MAX_WHY, "after the flush tenant %d's word %d is %d in memory, last written %d",
+                         t, a, mem[t * TENANT_SPACE + a], shadow[t * TENANT_SPACE + a]);
+                fail(why);
+            }
+        }
+    }
+}
+
+#ifdef USE_LIBFUZZER
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    input = data;
+    inputLeft = size;
+    fromInput = 1;
+    current.number++;
+    // The stream goes on as long as there are bytes to decide it
+    run_case(size / 8 < MAX_ACCESSES ? (int)(size / 8) : MAX_ACCESSES);
+    return 0;
+}
+
+#else
+
+int main(int argc, char *argv[])
+{
+    unsigned long long seed = argc > 1 ? strtoull(argv[1], NULL, 0) : 1;
+    long long cases = argc > 2 ? atoll(argv[2]) : 10000;
+    // xorshift can't start from 0
+    rngState = seed * 0x9E3779B97F4A7C15ULL | 1;
+    for (current.number = 0; current.number < cases; current.number++)
+    {
+        run_case(1 + choose(MAX_ACCESSES));
+    }
+    printf("fuzz: seed %llu, %lld cases, %lld accesses, no mismatches\n", seed, cases, totalAccesses);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,67 @@
+/*
+ * LC-2K instruction execution, see lc2k.h
+ */
+
+#include "lc2k.h"
+
+// Sign-extend a 16-bit offset field
+static int convert_num(int num)
+{
+    return num & (1 << 15) ? num - (1 << 16) : num;
+}
+
+enum lc2kStatus lc2k_execute(int *pc, int *reg, int instruction, const lc2kPorts *ports)
+{
+    int opcode = (instruction >> 22) & 0x7;
+    int regA = (instruction >> 19) & 0x7;
+    int regB = (instruction >> 16) & 0x7;
+    int destReg = instruction & 0x7;
+    int offset = convert_num(instruction & 0xFFFF);
+    enum lc2kStatus status = lc2kRunning;
+    int next = *pc + 1;
+    int fault = 0;
+
+    switch (opcode)
+    {
+    case 0: // add
+        reg[destReg] = reg[regA] + reg[regB];
+        break;
+    case 1: // nor
+        reg[destReg] = ~(reg[regA] | reg[regB]);
+        break;
+    case 2: // lw
+        fault = ports->load(*pc, reg[regA] + offset, &reg[regB]);
+        break;
+    case 3: // sw
+        fault = ports->store(*pc, reg[regA] + offset, reg[regB]);
+        break;
+    case 4: // beq
+        if (reg[regA] == reg[regB])
+        {
+            next += offset;
+        }
+        break;
+    case 5: // jalr
+        reg[regB] = *pc + 1;
+        next = reg[regA];
+        break;
+    case 6: // halt
+        status = lc2kHalted;
+        break;
+    default: // noop, or cflush, cclean or cinval
+        if (instruction & MAINTAINOPERATION)
+        {
+            fault = ports->maintain(*pc, (instruction & MAINTAINOPERATION) - 1, (instruction & MAINTAINALL) != 0,
+                                    reg[regA], reg[regB]);
+        }
+        break;
+    }
+    // Register 0 is always 0
+    reg[0] = 0;
+    if (fault)
+    {
+        return lc2kFault;
+    }
+    *pc = next;
+    return status;
+}
@@ -0,0 +1,43 @@
+/*
+ * The LC-2K instruction set, shared by the simulator and libcachesim so
+ * both run programs exactly the same way. lc2k_execute does the register
+ * and pc work of one instruction; memory and the cache are the caller's,
+ * reached through ports, which is also where each caller checks bounds
+ * and decides how to report a bad address.
+ */
+
+#ifndef LC2K_H
+#define LC2K_H
+
+// cflush, cclean and cinval are noops with an offset of 1, 2 or 3 (flush,
+// clean or invalidate) in these bits, plus MAINTAINALL for the whole cache
+#define MAINTAINOPERATION 0x3
+#define MAINTAINALL 0x4
+
+// What happened to the machine after one instruction
+enum lc2kStatus
+{
+    lc2kRunning,
+    lc2kHalted,
+    // A port refused the access; the pc still points at the instruction
+    lc2kFault
+};
+
+/*
+ * How an instruction reaches memory. Each port gets the pc of the
+ * instruction and returns 0, or -1 to stop the machine with lc2kFault.
+ *  -    load and store: a lw or sw at the effective address addr
+ *  -    maintain: cflush, cclean or cinval (operation 0, 1 or 2) of the
+ *       words words from addr, or of the whole cache if all is set
+ */
+typedef struct lc2kPorts
+{
+    int (*load)(int pc, int addr, int *value);
+    int (*store)(int pc, int addr, int value);
+    int (*maintain)(int pc, int operation, int all, int addr, int words);
+} lc2kPorts;
+
+// Run instruction on the machine with the given pc and registers
+enum lc2kStatus lc2k_execute(int *pc, int *reg, int instruction, const lc2kPorts *ports);
+
+#endif
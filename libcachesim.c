@@ -0,0 +1,377 @@
+/*
+ * libcachesim: LC-2K machine contexts for in-process cache simulation
+ * See libcachesim.h. Instructions run through lc2k_execute, as in the
+ * simulator, but bad addresses and the cache model's errors are reported
+ * to the caller instead of exiting.
+ */
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lc2k.h"
+#include "libcachesim.h"
+
+#define MEMORYSIZE 65536 /* maximum number of words in memory */
+#define NUMREGS 8
+#define MAXLINELENGTH 1000
+
+extern void cache_init(int blockSize, int numSets, int blocksPerSet);
+extern int cache_access(int addr, int write_flag, int write_data);
+extern int cache_set_option(const char *name, const char *value);
+extern void cache_clear_options(void);
+extern void cache_set_pc(int pc);
+extern void cache_instruction(void);
+extern void cache_get_stats(int *hits, int *misses, int *writebacks, int *dirtyBlocks);
+extern void cache_set_interval_hook(void (*hook)(int interval, long long accesses, long long instructions,
+                                                 int hits, int misses, int writebacks, int dirtyBlocks));
+extern void cache_finish_intervals(void);
+extern int cache_maintain(int operation, int addr, int words);
+extern int cache_maintain_all(int operation);
+extern void cache_final_flush(void);
+extern void memory_finish(void);
+extern void cache_catch_errors(jmp_buf *jump);
+extern const char *cache_error_message(void);
+
+struct cachesimContext
+{
+    // The program as loaded, to reset mem from
+    int image[MEMORYSIZE];
+    int imageWords;
+    int mem[MEMORYSIZE];
+    // mem[usedWords] and above are still zero
+    int usedWords;
+    int pc;
+    int reg[NUMREGS];
+    int memAccesses;
+    long long limit;
+    cachesimIntervalFn intervalFn;
+    void *intervalUser;
+};
+
+struct cachesimArena
+{
+    int contexts;
+    cachesimContext *slab;
+};
+
+// The context of the running simulation, whose memory mem_access uses
+static cachesimContext *active = NULL;
+
+// Why the last cachesim_run or cachesim_check_option failed
+static char lastError[MAXLINELENGTH];
+
+static void set_error(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vsnprintf(lastError, sizeof(lastError), format, args);
+    va_end(args);
+}
+
+int mem_access(int addr, int write_flag, int write_data)
+{
+    ++active->memAccesses;
+    if (write_flag)
+    {
+        active->mem[addr] = write_data;
+        if (active->usedWords <= addr)
+        {
+            active->usedWords = addr + 1;
+        }
+    }
+    return active->mem[addr];
+}
+
+int get_num_mem_accesses(void)
+{
+    return active->memAccesses;
+}
+
+cachesimArena *cachesim_arena_create(int contexts)
+{
+    cachesimArena *arena = malloc(sizeof(cachesimArena));
+    if (arena == NULL || contexts <= 0)
+    {
+        free(arena);
+        return NULL;
+    }
+    // Zeroed memory, so every context starts with usedWords 0 and mem clear
+    arena->slab = calloc(contexts, sizeof(cachesimContext));
+    if (arena->slab == NULL)
+    {
+        free(arena);
+        return NULL;
+    }
+    arena->contexts = contexts;
+    return arena;
+}
+
+void cachesim_arena_destroy(cachesimArena *arena)
+{
+    if (arena != NULL)
+    {
+        free(arena->slab);
+        free(arena);
+    }
+}
+
+cachesimContext *cachesim_context(cachesimArena *arena, int index)
+{
+    if (index < 0 || index >= arena->contexts)
+    {
+        return NULL;
+    }
+    return &arena->slab[index];
+}
+
+int cachesim_load_words(cachesimContext *context, const int *words, int count)
+{
+    if (count < 0 || count > MEMORYSIZE)
+    {
+        return -1;
+    }
+    memcpy(context->image, words, count * sizeof(int));
+    context->imageWords = count;
+    return 0;
+}
+
+int cachesim_load(cachesimContext *context, const char *path)
+{
+    char line[MAXLINELENGTH];
+    FILE *in = fopen(path, "r");
+    if (in == NULL)
+    {
+        return -1;
+    }
+    context->imageWords = 0;
+    while (fgets(line, MAXLINELENGTH, in) != NULL)
+    {
+        if (context->imageWords >= MEMORYSIZE ||
+            sscanf(line, "%x", &context->image[context->imageWords]) != 1)
+        {
+            fclose(in);
+            return -1;
+        }
+        context->imageWords++;
+    }
+    fclose(in);
+    return 0;
+}
+
+void cachesim_set_limit(cachesimContext *context, long long limit)
+{
+    context->limit = limit;
+}
+
+void cachesim_set_interval_callback(cachesimContext *context, cachesimIntervalFn fn, void *user)
+{
+    context->intervalFn = fn;
+    context->intervalUser = user;
+}
+
+// The cache's interval hook, passing intervals on to the running context's callback
+static void forward_interval(int interval, long long accesses, long long instructions, int hits, int misses,
+                             int writebacks, int dirtyBlocks)
+{
+    cachesimInterval stats = {interval, accesses, instructions, hits, misses, writebacks, dirtyBlocks};
+    active->intervalFn(&stats, active->intervalUser);
+}
+
+// Put the machine back to the loaded program, clearing only what was used
+static void reset_machine(cachesimContext *context)
+{
+    memcpy(context->mem, context->image, context->imageWords * sizeof(int));
+    if (context->usedWords > context->imageWords)
+    {
+        memset(context->mem + context->imageWords, 0,
+               (context->usedWords - context->imageWords) * sizeof(int));
+    }
+    context->usedWords = context->imageWords;
+    context->pc = 0;
+    memset(context->reg, 0, sizeof(context->reg));
+    context->memAccesses = 0;
+}
+
+// lw and sw through the cache, refusing addresses outside memory
+static int load_word(int pc, int addr, int *value)
+{
+    (void)pc;
+    if (addr < 0 || addr >= MEMORYSIZE)
+    {
+        return -1;
+    }
+    *value = cache_access(addr, 0, 0);
+    return 0;
+}
+
+static int store_word(int pc, int addr, int value)
+{
+    (void)pc;
+    if (addr < 0 || addr >= MEMORYSIZE)
+    {
+        return -1;
+    }
+    cache_access(addr, 1, value);
+    return 0;
+}
+
+static int maintain(int pc, int operation, int all, int addr, int words)
+{
+    (void)pc;
+    if (all)
+    {
+        cache_maintain_all(operation);
+    }
+    else if (addr < 0 || words < 0 || words > MEMORYSIZE - addr)
+    {
+        return -1;
+    }
+    else
+    {
+        cache_maintain(operation, addr, words);
+    }
+    return 0;
+}
+
+static const lc2kPorts ports = {load_word, store_word, maintain};
+
+// Run one instruction; returns 1 on halt, -1 on an error, 0 otherwise
+static int step(cachesimContext *context)
+{
+    if (context->pc < 0 || context->pc >= context->usedWords)
+    {
+        set_error("pc %d is outside the program", context->pc);
+        return -1;
+    }
+    cache_set_pc(context->pc);
+    int instruction = cache_access(context->pc, 0, 0);
+    switch (lc2k_execute(&context->pc, context->reg, instruction, &ports))
+    {
+    case lc2kHalted:
+        return 1;
+    case lc2kFault:
+        set_error("the instruction at pc %d accessed an address outside memory", context->pc);
+        return -1;
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Cache options that only the simulator's front end acts on: more cores
+ * or tenants, MSHR timing, parallel trace replay, and the statistics
+ * printStats prints or writes to a stats file. A context is one silent,
+ * in-order machine on core 0, so they're refused rather than ignored.
+ */
+static const char *const unsupportedOptions[] = {"cores", "tenants", "mshrs", "hit-latency", "threads",
+                                                 "stats", "quiet"};
+
+// Give the cache one name=value option; 0 if it took it, -1 otherwise
+static int set_option(const char *option)
+{
+    char name[MAXLINELENGTH];
+    const char *equals = strchr(option, '=');
+    if (equals == NULL || equals - option >= MAXLINELENGTH)
+    {
+        set_error("option %s isn't name=value", option);
+        return -1;
+    }
+    memcpy(name, option, equals - option);
+    name[equals - option] = '\0';
+    for (size_t u = 0; u < sizeof(unsupportedOptions) / sizeof(unsupportedOptions[0]); u++)
+    {
+        if (!strcmp(name, unsupportedOptions[u]))
+        {
+            set_error("option %s needs the simulator", name);
+            return -1;
+        }
+    }
+    if (cache_set_option(name, equals + 1) != 0)
+    {
+        set_error("unknown option %s", name);
+        return -1;
+    }
+    return 0;
+}
+
+int cachesim_check_option(const char *option)
+{
+    jmp_buf jump;
+    lastError[0] = '\0';
+    cache_clear_options();
+    if (setjmp(jump))
+    {
+        cache_catch_errors(NULL);
+        set_error("%s", cache_error_message());
+        cache_clear_options();
+        return -1;
+    }
+    cache_catch_errors(&jump);
+    int status = set_option(option);
+    cache_catch_errors(NULL);
+    cache_clear_options();
+    return status;
+}
+
+const char *cachesim_error(void)
+{
+    return lastError;
+}
+
+int cachesim_run(cachesimContext *context, int blockSize, int numSets, int blocksPerSet,
+                 int numOptions, const char *const *options, cachesimResults *results)
+{
+    // Errors in the cache model, from a bad option to a verify=1 divergence,
+    // come back here rather than exiting
+    jmp_buf jump;
+    lastError[0] = '\0';
+    if (setjmp(jump))
+    {
+        cache_catch_errors(NULL);
+        set_error("%s", cache_error_message());
+        memory_finish();
+        return -1;
+    }
+    cache_catch_errors(&jump);
+    cache_clear_options();
+    cache_set_option("quiet", "1");
+    for (int i = 0; i < numOptions; i++)
+    {
+        if (set_option(options[i]) != 0)
+        {
+            cache_catch_errors(NULL);
+            return -1;
+        }
+    }
+    cache_set_interval_hook(context->intervalFn != NULL ? forward_interval : NULL);
+    cache_init(blockSize, numSets, blocksPerSet);
+
+    reset_machine(context);
+    active = context;
+    int status = 0;
+    long long instructions = 0;
+    while (status == 0)
+    {
+        if (context->limit && instructions == context->limit)
+        {
+            set_error("the program ran past the limit of %lld instructions", context->limit);
+            status = -1;
+            break;
+        }
+        status = step(context);
+        instructions++;
+        cache_instruction();
+    }
+    cache_final_flush();
+    cache_finish_intervals();
+    memory_finish();
+    cache_catch_errors(NULL);
+
+    results->instructions = instructions;
+    results->memAccesses = context->memAccesses;
+    cache_get_stats(&results->hits, &results->misses, &results->writebacks, &results->dirtyBlocks);
+    return status == 1 ? 0 : -1;
+}
@@ -0,0 +1,88 @@
+/*
+ * libcachesim: run LC-2K programs through the cache model in-process
+ *
+ * A context holds one loaded program and the machine state it runs in.
+ * Contexts come from an arena allocated once up front, and every run
+ * resets its context in place, touching only the memory the previous run
+ * used, so a harness can sweep thousands of cache configurations without
+ * allocating or starting processes. A context owns its machine but not
+ * its cache: the cache model is the simulator's single global instance,
+ * set up afresh by every run, so runs happen one at a time.
+ *
+ * Nothing here exits the process: an invalid cache configuration, a
+ * verify=1 divergence or a program error makes the call return -1, and
+ * cachesim_error says why. A divergence still prints the reference
+ * model's report and the cache first, as it does in the simulator.
+ */
+
+#ifndef LIBCACHESIM_H
+#define LIBCACHESIM_H
+
+typedef struct cachesimArena cachesimArena;
+typedef struct cachesimContext cachesimContext;
+
+// What one run produced
+typedef struct cachesimResults
+{
+    long long instructions;
+    int hits;
+    int misses;
+    int writebacks;
+    int dirtyBlocks;
+    int memAccesses;
+} cachesimResults;
+
+// The statistics of one interval of a run, see the interval option
+typedef struct cachesimInterval
+{
+    int interval;
+    long long accesses;
+    long long instructions;
+    int hits;
+    int misses;
+    int writebacks;
+    int dirtyBlocks;
+} cachesimInterval;
+
+typedef void (*cachesimIntervalFn)(const cachesimInterval *interval, void *user);
+
+// An arena of contexts, or NULL if there isn't enough memory
+cachesimArena *cachesim_arena_create(int contexts);
+void cachesim_arena_destroy(cachesimArena *arena);
+cachesimContext *cachesim_context(cachesimArena *arena, int index);
+
+// Load a machine-code file or an array of words; 0 on success, -1 on error
+int cachesim_load(cachesimContext *context, const char *path);
+int cachesim_load_words(cachesimContext *context, const int *words, int count);
+
+// Stop runs that execute more than limit instructions (0, the default, is no limit)
+void cachesim_set_limit(cachesimContext *context, long long limit);
+
+/*
+ * Call fn with every interval of the runs of context, the last one
+ * partial, as they happen; NULL turns it off. The interval and
+ * interval-unit options of each run set the intervals.
+ */
+void cachesim_set_interval_callback(cachesimContext *context, cachesimIntervalFn fn, void *user);
+
+/*
+ * Run the loaded program from a fresh machine through a cache with the
+ * given geometry and name=value options, without printing anything.
+ * With final-flush=1 the caches are flushed when the run ends, so
+ * writebacks and memAccesses include every dirty block and dirtyBlocks is
+ * 0. Returns 0 if the program halted, -1 if it failed or hit the limit,
+ * if the configuration is invalid, or if an option is unknown or needs
+ * the simulator's front end (cores, tenants, mshrs, hit-latency, threads,
+ * stats and quiet, as well as the simulator's own options such as
+ * page-size).
+ */
+int cachesim_run(cachesimContext *context, int blockSize, int numSets, int blocksPerSet,
+                 int numOptions, const char *const *options, cachesimResults *results);
+
+// 0 if cachesim_run takes the name=value option, -1 if it would refuse it
+int cachesim_check_option(const char *option);
+
+// Why the last cachesim_run or cachesim_check_option returned -1, or ""
+const char *cachesim_error(void);
+
+#endif
@@ -0,0 +1,376 @@
+/*
+ * Backing memory timing models
+ * cache.c hands every block fill and writeback to memory_transfer, which
+ * returns its latency in cycles under the selected model:
+ *  -    flat: every transfer takes memory-latency cycles
+ *  -    dram: banks with row buffers, an open- or closed-page policy and
+ *             DDR-style timings, so row-buffer locality and bank conflicts
+ *             show up in the latency
+ * The data itself still lives behind mem_access; this only models time.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_BANKS 64
+#define MAX_OPTION_LENGTH 1000
+
+// Reports a bad option or configuration and stops, see cache.c
+extern void cache_error(const char *format, ...) __attribute__((noreturn));
+
+typedef struct memoryModel
+{
+    const char *name;
+    void (*reset)(void);
+    // Latency in cycles of moving words words starting at addr
+    int (*transfer)(int addr, int words, int write_flag);
+    void (*print_stats)(void);
+} memoryModel;
+
+// Per-bank row buffer; openRow is -1 while the bank is precharged
+typedef struct bankStruct
+{
+    int openRow;
+} bankStruct;
+
+// Latency totals for one kind of transfer
+typedef struct transferStats
+{
+    long long count;
+    long long cycles;
+    int minCycles;
+    int maxCycles;
+} transferStats;
+
+// flat model settings
+static int flatLatency = 100;
+
+// dram model settings, in memory cycles
+static int numBanks = 8;
+static int rowWords = 1024;
+static int closedPage = 0;
+static int tRCD = 14;
+static int tCAS = 14;
+static int tRP = 14;
+static int tBurst = 1;
+
+// dram model state and row-buffer outcome counts
+static bankStruct banks[MAX_BANKS];
+static long long rowHits;
+static long long rowEmpty;
+static long long rowConflicts;
+
+static const memoryModel *model;
+static int configured = 0;
+static transferStats fills;
+static transferStats writebacks;
+static char logFile[MAX_OPTION_LENGTH];
+static FILE *logOut = NULL;
+
+static void flat_reset(void)
+{
+}
+
+static int flat_transfer(int addr, int words, int write_flag)
+{
+    (void)addr;
+    (void)words;
+    (void)write_flag;
+    return flatLatency;
+}
+
+static void flat_print_stats(void)
+{
+}
+
+static void dram_reset(void)
+{
+    for (int b = 0; b < numBanks; b++)
+    {
+        banks[b].openRow = -1;
+    }
+    rowHits = 0;
+    rowEmpty = 0;
+    rowConflicts = 0;
+}
+
+/*
+ * Rows are interleaved across banks, so consecutive rows of the address
+ * space land in different banks. A transfer is assumed to stay inside one
+ * row, which holds because memory_init makes rows a whole number of
+ * blocks and transfers never cross a block.
+ */
+static int dram_transfer(int addr, int words, int write_flag)
+{
+    (void)write_flag;
+    int bank = (addr / rowWords) % numBanks;
+    int row = addr / (rowWords * numBanks);
+    int cycles = tCAS + words * tBurst;
+    if (banks[bank].openRow == row)
+    {
+        rowHits++;
+    }
+    else if (banks[bank].openRow == -1)
+    {
+        rowEmpty++;
+        cycles += tRCD;
+    }
+    else
+    {
+        rowConflicts++;
+        cycles += tRP + tRCD;
+    }
+    // A closed-page controller precharges right after the access, off the
+    // critical path of the next one
+    banks[bank].openRow = closedPage ? -1 : row;
+    return cycles;
+}
+
+static void dram_print_stats(void)
+{
+    long long total = rowHits + rowEmpty + rowConflicts;
+    printf("dram: %d banks of %d-word rows, %s page, tRCD %d tCAS %d tRP %d burst %d\n",
+           numBanks, rowWords, closedPage ? "closed" : "open", tRCD, tCAS, tRP, tBurst);
+    printf("dram: row hits %lld, row misses %lld (%lld to a precharged bank, %lld conflicts), row hit rate %.4f\n",
+           rowHits, rowEmpty + rowConflicts, rowEmpty, rowConflicts,
+           total ? (double)rowHits / total : 0.0);
+}
+
+static const memoryModel models[] = {
+    {"flat", flat_reset, flat_transfer, flat_print_stats},
+    {"dram", dram_reset, dram_transfer, dram_print_stats},
+};
+
+/*
+ * Set an option of the memory model. Returns 0 if the option was
+ * recognized, -1 otherwise.
+ *  -    memory=flat|dram: the model (default flat)
+ *  -    memory-latency=<cycles>: flat model latency
+ *  -    memory-log=<file>: write one CSV line per transfer
+ *  -    dram-banks=<n>, dram-row=<words>, dram-page=open|closed,
+ *       dram-trcd=<cycles>, dram-tcas=<cycles>, dram-trp=<cycles>,
+ *       dram-burst=<cycles per word>: dram model geometry and timings
+ */
+int memory_set_option(const char *name, const char *value)
+{
+    int *setting = NULL;
+    if (!strcmp(name, "memory"))
+    {
+        model = NULL;
+        for (size_t i = 0; i < sizeof(models) / sizeof(models[0]); i++)
+        {
+            if (!strcmp(value, models[i].name))
+            {
+                model = &models[i];
+            }
+        }
+        if (model == NULL)
+        {
+            cache_error("memory must be flat or dram");
+        }
+    }
+    else if (!strcmp(name, "memory-log"))
+    {
+        if (strlen(value) >= MAX_OPTION_LENGTH)
+        {
+            cache_error("value for option %s is too long", name);
+        }
+        strcpy(logFile, value);
+    }
+    else if (!strcmp(name, "dram-page"))
+    {
+        if (strcmp(value, "open") && strcmp(value, "closed"))
+        {
+            cache_error("dram-page must be open or closed");
+        }
+        closedPage = !strcmp(value, "closed");
+    }
+    else if (!strcmp(name, "memory-latency"))
+    {
+        setting = &flatLatency;
+    }
+    else if (!strcmp(name, "dram-banks"))
+    {
+        setting = &numBanks;
+    }
+    else if (!strcmp(name, "dram-row"))
+    {
+        setting = &rowWords;
+    }
+    else if (!strcmp(name, "dram-trcd"))
+    {
+        setting = &tRCD;
+    }
+    else if (!strcmp(name, "dram-tcas"))
+    {
+        setting = &tCAS;
+    }
+    else if (!strcmp(name, "dram-trp"))
+    {
+        setting = &tRP;
+    }
+    else if (!strcmp(name, "dram-burst"))
+    {
+        setting = &tBurst;
+    }
+    else
+    {
+        return -1;
+    }
+    if (setting != NULL)
+    {
+        *setting = atoi(value);
+    }
+    configured = 1;
+    return 0;
+}
+
+// Go back to the default flat model and settings
+void memory_clear_options(void)
+{
+    model = NULL;
+    configured = 0;
+    logFile[0] = '\0';
+    flatLatency = 100;
+    numBanks = 8;
+    rowWords = 1024;
+    closedPage = 0;
+    tRCD = 14;
+    tCAS = 14;
+    tRP = 14;
+    tBurst = 1;
+}
+
+// Close the memory log, so a later run in the same process can't append to it
+void memory_finish(void)
+{
+    if (logOut != NULL)
+    {
+        fclose(logOut);
+        logOut = NULL;
+    }
+}
+
+// Check the settings and start from idle banks; called by cache_init
+void memory_init(int blockSize)
+{
+    if (model == NULL)
+    {
+        model = &models[0];
+    }
+    if (numBanks <= 0 || numBanks > MAX_BANKS)
+    {
+        cache_error("dram-banks must be between 1 and %d", MAX_BANKS);
+    }
+    if (rowWords < blockSize || rowWords % blockSize)
+    {
+        cache_error("dram-row must be a multiple of the block size (%d words)", blockSize);
+    }
+    if (flatLatency < 0 || tRCD < 0 || tCAS < 0 || tRP < 0 || tBurst < 0)
+    {
+        cache_error("memory timings can't be negative");
+    }
+    memset(&fills, 0, sizeof(fills));
+    memset(&writebacks, 0, sizeof(writebacks));
+    memory_finish();
+    if (logFile[0])
+    {
+        logOut = fopen(logFile, "w");
+        if (logOut == NULL)
+        {
+            cache_error("can't open memory log %s", logFile);
+        }
+        fprintf(logOut, "kind,addr,words,cycles\n");
+    }
+    model->reset();
+}
+
+/*
+ * Time one block fill (write_flag 0) or writeback (write_flag 1) and
+ * return its latency in cycles.
+ */
+int memory_transfer(int addr, int words, int write_flag)
+{
+    int cycles = model->transfer(addr, words, write_flag);
+    transferStats *stats = write_flag ? &writebacks : &fills;
+    if (stats->count == 0 || cycles < stats->minCycles)
+    {
+        stats->minCycles = cycles;
+    }
+    if (stats->count == 0 || cycles > stats->maxCycles)
+    {
+        stats->maxCycles = cycles;
+    }
+    stats->count++;
+    stats->cycles += cycles;
+    if (logOut != NULL)
+    {
+        fprintf(logOut, "%s,%d,%d,%d\n", write_flag ? "writeback" : "fill", addr, words, cycles);
+    }
+    return cycles;
+}
+
+/*
+ * Append the model's state to a checkpoint after the cache's, so a
+ * restored run goes on with the same transfer counts and open rows
+ */
+void memory_checkpoint_save(FILE *out)
+{
+    int header[2] = {(int)(model - models), numBanks};
+    long long rows[3] = {rowHits, rowEmpty, rowConflicts};
+    if (fwrite(header, sizeof(int), 2, out) != 2 || fwrite(&fills, sizeof(transferStats), 1, out) != 1 ||
+        fwrite(&writebacks, sizeof(transferStats), 1, out) != 1 ||
+        fwrite(banks, sizeof(bankStruct), numBanks, out) != (size_t)numBanks ||
+        fwrite(rows, sizeof(long long), 3, out) != 3)
+    {
+        cache_error("failed to write the memory model to the checkpoint");
+    }
+}
+
+// Read what memory_checkpoint_save wrote; memory_init must already have run
+void memory_checkpoint_load(FILE *in)
+{
+    int header[2];
+    long long rows[3];
+    if (fread(header, sizeof(int), 2, in) != 2)
+    {
+        cache_error("truncated memory model checkpoint");
+    }
+    if (header[0] != (int)(model - models) || header[1] != numBanks)
+    {
+        cache_error("checkpoint is for another memory model or number of banks");
+    }
+    if (fread(&fills, sizeof(transferStats), 1, in) != 1 || fread(&writebacks, sizeof(transferStats), 1, in) != 1 ||
+        fread(banks, sizeof(bankStruct), numBanks, in) != (size_t)numBanks || fread(rows, sizeof(long long), 3, in) != 3)
+    {
+        cache_error("truncated memory model checkpoint");
+    }
+    rowHits = rows[0];
+    rowEmpty = rows[1];
+    rowConflicts = rows[2];
+}
+
+static void print_transfer_stats(const char *kind, const transferStats *stats)
+{
+    printf("memory: %lld %s, %lld cycles", stats->count, kind, stats->cycles);
+    if (stats->count)
+    {
+        printf(" (average %.2f, min %d, max %d)", (double)stats->cycles / stats->count,
+               stats->minCycles, stats->maxCycles);
+    }
+    printf("\n");
+}
+
+// Report memory timing; silent unless a memory option was given
+void memory_print_stats(void)
+{
+    memory_finish();
+    if (!configured)
+    {
+        return;
+    }
+    print_transfer_stats("block fills", &fills);
+    print_transfer_stats("writebacks", &writebacks);
+    model->print_stats();
+}
@@ -11,15 +11,32 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "lc2k.h"
+
 // DO NOT CHANGE THE FOLLOWING DEFINITIONS
 
 // Machine Definitions
 #define MEMORYSIZE 65536 /* maximum number of words in memory (maximum number of lines in a given file)*/
 #define NUMREGS 8        /* total number of machine registers [0,7] */
+#define MAXCORES 16      /* most cores a multi-core run can have */
+#define MAXTENANTS 8     /* most programs that can share the cache */
+#define MAXPAGELEVELS 4  /* deepest page table */
+#define MAXTLBENTRIES 1024
+#define TLB2LATENCY 4    /* cycles an L2 TLB lookup adds in timing mode */
+#define MAXBHTENTRIES 4096
 
 // File Definitions
 #define MAXLINELENGTH 1000 /* MAXLINELENGTH is the max number of characters we read */
 
+// Checkpoint file header: "LC2K" and the layout version of the machine section
+#define CHECKPOINT_MAGIC 0x4B32434C
+#define CHECKPOINT_VERSION 1
+
+// Kinds of trace records, matching enum traceKind in trace.c
+#define TRACE_FETCH 0
+#define TRACE_LOAD 1
+#define TRACE_STORE 2
+
 // Define stateType before declaring functions
 typedef struct
 {
@@ -29,6 +46,36 @@ typedef struct
     int numMemory;
 } stateType;
 
+// Per-core state of a multi-core run. The running core's pc and registers
+// live in state; the other cores' are parked here until their turn.
+typedef struct
+{
+    int pc;
+    int reg[NUMREGS];
+    bool halted;
+    int instructions;
+} coreType;
+
+// A program of a shared-cache run, with its own machine state
+typedef struct
+{
+    stateType *state;
+    const char *file;
+    bool halted;
+    int instructions;
+} tenantType;
+
+// A translation lookaside buffer: fully associative with LRU replacement
+typedef struct
+{
+    int vpn[MAXTLBENTRIES];
+    long long lastUse[MAXTLBENTRIES];
+    int size;
+    int used;
+    long long hits;
+    long long misses;
+} tlbType;
+
 // Forward declarations of helper functions
 // Forward declarations of helper functions
 static int getOpcode(int instruction);
@@ -43,50 +90,656 @@ static inline int convertNum(int32_t num);
 void printState(stateType *);
 
 extern void cache_init(int blockSize, int numSets, int blocksPerSet);
-extern int cache_access(int addr, int write_flag, int write_data);
+extern int cache_access_core(int core, int addr, int write_flag, int write_data);
+extern int cache_access_tenant(int tenant, int addr, int write_flag, int write_data);
+extern int cache_access_timed(int addr, int write_flag, int write_data, long long *cycle, long long *ready);
+extern int cache_last_access_cycles(void);
+extern int cache_maintain(int operation, int addr, int words);
+extern int cache_maintain_all(int operation);
+extern void cache_final_flush(void);
+extern int cache_set_option(const char *name, const char *value);
+extern void cache_set_pc(int pc);
+extern void cache_instruction(void);
+extern void cache_checkpoint_save(FILE *out);
+extern void cache_checkpoint_load(FILE *in);
 extern void printStats();
+extern void trace_open_write(const char *path);
+extern void trace_record(int kind, int pc, int addr);
+extern void trace_close_write(void);
 static stateType state;
 static int num_mem_accesses = 0;
+static int num_instructions = 0;
+
+// Checkpoint options: where to save, after how many instructions, what to restore
+static const char *checkpointFile = NULL;
+static int checkpointAt = -1;
+static bool checkpointWritten = false;
+static const char *restoreFile = NULL;
+
+// Cores take turns executing one instruction each, in core order
+static coreType cores[MAXCORES];
+static int numCores = 1;
+static int currentCore = 0;
+
+/*
+ * Shared-cache runs (corun=<file>,...): the loaded program is tenant 0 and
+ * every corun program is another tenant with its own memory and registers,
+ * all taking turns one instruction at a time on one cache. machine is the
+ * running tenant's state; without corun it is always state.
+ */
+static tenantType tenants[MAXTENANTS] = {{&state}};
+static int numTenants = 1;
+static int currentTenant = 0;
+static stateType *machine = &state;
+
+// Record every fetch, lw and sw to this trace file when set
+static const char *traceFile = NULL;
+
+/*
+ * Non-blocking timing mode (mshrs=<n>). Instructions issue in order, but
+ * only wait for a load's data when they use it, so independent lws can
+ * issue while earlier misses are still outstanding. cycle is when the next
+ * instruction is fetched, issueCycle when the current one issues, and
+ * regReady when each register's value becomes available.
+ */
+static bool timing = false;
+static int hitLatency = 1;
+static long long cycle = 0;
+static long long issueCycle = 0;
+static long long lastReady = 0;
+static long long regReady[NUMREGS];
+static long long fetchStalls = 0;
+static long long operandStalls = 0;
+static long long mshrStalls = 0;
+
+/*
+ * Pipelined timing mode (pipeline=1): the classic five stages, in order,
+ * with full forwarding into EX. A lw's data only reaches EX from WB, so an
+ * instruction using it straight away waits a cycle. beq is predicted in IF,
+ * not taken (branch-predict=not-taken, the default) or by bht-entries=<n>
+ * 2-bit counters indexed by pc that start strongly not taken
+ * (branch-predict=2bit, with the target assumed known). It is resolved in
+ * MEM, so a misprediction fetches the right instruction 3 cycles late;
+ * jalr always costs 2, as it is resolved in EX. The cache is blocking,
+ * with a port for IF and one for MEM: an access keeps its stage busy for
+ * as long as it takes, and the instructions behind it wait. Only the path
+ * actually taken is fetched. stageStart is when the last instruction
+ * entered each stage, and stageStart[NUMSTAGES] when it left WB.
+ */
+enum pipelineStage
+{
+    stageIF,
+    stageID,
+    stageEX,
+    stageMEM,
+    stageWB,
+    NUMSTAGES
+};
+static bool pipelining = false;
+static bool twoBitPredictor = false;
+static int bhtEntries = 64;
+static unsigned char bht[MAXBHTENTRIES];
+static long long stageStart[NUMSTAGES + 1];
+// Cycle each register's newest value can be forwarded into EX
+static long long forwardReady[NUMREGS];
+// Earliest fetch of the instruction after a misprediction
+static long long redirectAt = 0;
+// Cycles the memory accesses since the pipeline last looked took
+static long long accessCycles = 0;
+static long long branches = 0;
+static long long mispredictions = 0;
+static long long jumps = 0;
+static long long redirectCycles = 0;
+static long long loadUseStalls = 0;
+static long long fetchMissCycles = 0;
+static long long memoryMissCycles = 0;
+
+/*
+ * Virtual memory (page-size=<words>). Every fetch, lw and sw address is
+ * translated through an L1 and an optional L2 TLB; a miss in both walks a
+ * page-table-levels deep radix page table kept at the top of state.mem, and
+ * every page-table entry the walk reads is an access through the cache.
+ * An entry is (address of the next table, or the page number) << 1 | 1,
+ * and 0 while not present. Missing entries are filled in on the walk, with
+ * cache writes, as a page-fault handler would. Pages map to the frame with
+ * the same number, so programs see the memory they always did.
+ * With pipt the L1 TLB lookup delays every access in timing mode; with vipt
+ * it overlaps the cache lookup.
+ */
+static int pageSize = 0;
+static int pageLevels = 2;
+static bool vipt = false;
+static tlbType tlb1 = {.size = 16};
+static tlbType tlb2 = {.size = 128};
+static int vpnBits;
+static int levelBits[MAXPAGELEVELS];
+static int pageTableRoot;
+// Lowest word of memory used by page tables, and the highest the program used
+static int pageTableBase = MEMORYSIZE;
+static int highestAddress = 0;
+static long long tlbClock = 0;
+static long long pageWalks = 0;
+static long long walkAccesses = 0;
+static long long pageFaults = 0;
+static int tablesAllocated = 0;
+static long long translationStalls = 0;
+
+/*
+ * Memory traffic at physical addresses: it is recorded to the trace if
+ * there is one and then handed to the running core's cache. In timing mode
+ * the access issues at *at.
+ */
+static int physicalAccess(int kind, int pc, int addr, int write_data, long long *at)
+{
+    if (traceFile != NULL)
+    {
+        trace_record(kind, pc, addr);
+    }
+    cache_set_pc(pc);
+    if (numTenants > 1)
+    {
+        return cache_access_tenant(currentTenant, addr, kind == TRACE_STORE, write_data);
+    }
+    if (timing)
+    {
+        long long requested = *at;
+        int result = cache_access_timed(addr, kind == TRACE_STORE, write_data, at, &lastReady);
+        mshrStalls += *at - requested;
+        return result;
+    }
+    int result = cache_access_core(currentCore, addr, kind == TRACE_STORE, write_data);
+    if (pipelining)
+    {
+        accessCycles += cache_last_access_cycles();
+    }
+    return result;
+}
+
+// Look vpn up in tlb, making it the most recently used entry on a hit
+static bool tlbLookup(tlbType *tlb, int vpn)
+{
+    for (int i = 0; i < tlb->used; i++)
+    {
+        if (tlb->vpn[i] == vpn)
+        {
+            tlb->lastUse[i] = ++tlbClock;
+            tlb->hits++;
+            return true;
+        }
+    }
+    tlb->misses++;
+    return false;
+}
+
+static void tlbInsert(tlbType *tlb, int vpn)
+{
+    int entry = tlb->used;
+    if (tlb->used < tlb->size)
+    {
+        tlb->used++;
+    }
+    else
+    {
+        entry = 0;
+        for (int i = 1; i < tlb->used; i++)
+        {
+            if (tlb->lastUse[i] < tlb->lastUse[entry])
+            {
+                entry = i;
+            }
+        }
+    }
+    tlb->vpn[entry] = vpn;
+    tlb->lastUse[entry] = ++tlbClock;
+}
+
+// Timing mode: translation holds the access back by cycles
+static void translationDelay(long long *at, long long cycles)
+{
+    if (timing)
+    {
+        *at += cycles;
+        translationStalls += cycles;
+    }
+    else if (pipelining)
+    {
+        accessCycles += cycles;
+        translationStalls += cycles;
+    }
+}
+
+// Take a zeroed table for the given level from the top of memory
+static int allocateTable(int level)
+{
+    pageTableBase -= 1 << levelBits[level];
+    if (pageTableBase <= highestAddress || pageTableBase < state.numMemory)
+    {
+        printf("error: the page tables ran into memory the program uses\n");
+        exit(1);
+    }
+    tablesAllocated++;
+    return pageTableBase;
+}
+
+/*
+ * Walk the page table for vpn through the cache, filling in missing
+ * entries, and return the page number it maps to. Walk reads depend on
+ * each other, so in timing mode each one waits for the last.
+ */
+static int pageWalk(int pc, int vpn, long long *at)
+{
+    int table = pageTableRoot;
+    int shift = vpnBits;
+    pageWalks++;
+    for (int level = 0; level < pageLevels; level++)
+    {
+        shift -= levelBits[level];
+        int entryAddr = table + ((vpn >> shift) & ((1 << levelBits[level]) - 1));
+        int entry = physicalAccess(TRACE_LOAD, pc, entryAddr, 0, at);
+        walkAccesses++;
+        if (timing)
+        {
+            translationStalls += lastReady - *at;
+            *at = lastReady;
+        }
+        if (!(entry & 1))
+        {
+            pageFaults++;
+            entry = (level + 1 < pageLevels ? allocateTable(level + 1) : vpn) << 1 | 1;
+            physicalAccess(TRACE_STORE, pc, entryAddr, entry, at);
+            walkAccesses++;
+        }
+        table = entry >> 1;
+    }
+    return table;
+}
+
+// Translate the virtual word address addr
+static int translate(int pc, int addr, long long *at)
+{
+    if (addr >= pageTableBase)
+    {
+        fprintf(stderr, "Error: Memory access at PC %d to address %d, which holds page tables\n", pc, addr);
+        exit(1);
+    }
+    if (addr > highestAddress)
+    {
+        highestAddress = addr;
+    }
+    int vpn = addr / pageSize;
+    int ppn;
+    if (tlbLookup(&tlb1, vpn))
+    {
+        translationDelay(at, vipt ? 0 : 1);
+        ppn = vpn;
+    }
+    else if (tlb2.size && tlbLookup(&tlb2, vpn))
+    {
+        translationDelay(at, TLB2LATENCY);
+        tlbInsert(&tlb1, vpn);
+        ppn = vpn;
+    }
+    else
+    {
+        ppn = pageWalk(pc, vpn, at);
+        tlbInsert(&tlb1, vpn);
+        if (tlb2.size)
+        {
+            tlbInsert(&tlb2, vpn);
+        }
+    }
+    return ppn * pageSize + addr % pageSize;
+}
+
+/*
+ * All of the machine's memory traffic goes through here: translated if
+ * paging is on, then passed on to physicalAccess.
+ */
+static int memoryAccess(int kind, int pc, int addr, int write_data)
+{
+    long long *at = kind == TRACE_FETCH ? &cycle : &issueCycle;
+    if (pageSize)
+    {
+        addr = translate(pc, addr, at);
+    }
+    return physicalAccess(kind, pc, addr, write_data, at);
+}
+
+// Whether instruction is cflush, cclean or cinval rather than a plain noop
+static bool isCacheMaintenance(int instruction)
+{
+    return getOpcode(instruction) == 7 && (instruction & MAINTAINOPERATION);
+}
+
+/*
+ * cflush, cclean and cinval cover the words words from addr, translated a
+ * page at a time if paging is on, or the whole cache. The writebacks they
+ * cause hold up timing and pipelined runs.
+ */
+static int maintainCache(int pc, int operation, int all, int addr, int words)
+{
+    long long cycles = 0;
+    if (all)
+    {
+        cycles = cache_maintain_all(operation);
+    }
+    else
+    {
+        if (addr < 0 || words < 0 || words > MEMORYSIZE - addr)
+        {
+            fprintf(stderr, "Error: Cache maintenance out of bounds at PC %d (%d words from address %d)\n",
+                    pc, words, addr);
+            exit(1);
+        }
+        while (words > 0)
+        {
+            int chunk = pageSize && pageSize - addr % pageSize < words ? pageSize - addr % pageSize : words;
+            int physical = pageSize ? translate(pc, addr, &issueCycle) : addr;
+            cycles += cache_maintain(operation, physical + currentTenant * MEMORYSIZE, chunk);
+            addr += chunk;
+            words -= chunk;
+        }
+    }
+    if (timing)
+    {
+        issueCycle += cycles;
+    }
+    else if (pipelining)
+    {
+        accessCycles += cycles;
+    }
+    return 0;
+}
+
+// Check the paging options, split the page number between the levels and
+// allocate the root table
+static void initPaging(int blockSize, int numSets)
+{
+    if (pageSize <= 0 || pageSize >= MEMORYSIZE || (pageSize & (pageSize - 1)))
+    {
+        printf("error: page-size must be a power of 2 below %d\n", MEMORYSIZE);
+        exit(1);
+    }
+    vpnBits = 0;
+    while ((pageSize << vpnBits) < MEMORYSIZE)
+    {
+        vpnBits++;
+    }
+    if (pageLevels < 1 || pageLevels > MAXPAGELEVELS || pageLevels > vpnBits)
+    {
+        printf("error: page-levels must be between 1 and %d, and at most %d with this page size\n",
+               MAXPAGELEVELS, vpnBits);
+        exit(1);
+    }
+    if (tlb1.size < 1 || tlb1.size > MAXTLBENTRIES || tlb2.size < 0 || tlb2.size > MAXTLBENTRIES)
+    {
+        printf("error: tlb must be between 1 and %d entries and tlb2 between 0 and %d\n",
+               MAXTLBENTRIES, MAXTLBENTRIES);
+        exit(1);
+    }
+    if (numCores > 1 || numTenants > 1)
+    {
+        printf("error: page-size can't be combined with cores or corun\n");
+        exit(1);
+    }
+    if (vipt && blockSize * numSets > pageSize)
+    {
+        printf("warning: with vipt the cache index uses address bits above the page offset\n");
+    }
+    for (int level = 0; level < pageLevels; level++)
+    {
+        levelBits[level] = vpnBits / pageLevels + (level < vpnBits % pageLevels);
+    }
+    pageTableRoot = allocateTable(0);
+}
+
+static void printPagingStats(void)
+{
+    printf("paging: %d-word pages, %d-level page table, %d tables in [%d-%d], %lld page faults\n",
+           pageSize, pageLevels, tablesAllocated, pageTableBase, MEMORYSIZE - 1, pageFaults);
+    printf("tlb: L1 %d entries, hits %lld, misses %lld", tlb1.size, tlb1.hits, tlb1.misses);
+    if (tlb2.size)
+    {
+        printf("; L2 %d entries, hits %lld, misses %lld", tlb2.size, tlb2.hits, tlb2.misses);
+    }
+    printf("\n");
+    printf("tlb: %lld page walks making %lld cache accesses (%s)\n",
+           pageWalks, walkAccesses, vipt ? "vipt" : "pipt");
+}
+
+// Registers an instruction reads and writes, -1 where there is none
+static void getOperands(int instruction, int *srcA, int *srcB, int *dest)
+{
+    int opcode = getOpcode(instruction);
+    bool range = isCacheMaintenance(instruction) && !(instruction & MAINTAINALL);
+    *srcA = opcode <= 5 || range ? getRegA(instruction) : -1;
+    *srcB = opcode == 0 || opcode == 1 || opcode == 3 || opcode == 4 || range ? getRegB(instruction) : -1;
+    *dest = opcode <= 1 ? getDestReg(instruction) : (opcode == 2 || opcode == 5 ? getRegB(instruction) : -1);
+}
+
+// Timing mode: find when the just-fetched instruction can issue
+static void timingIssue(int instruction)
+{
+    int srcA, srcB, dest;
+    getOperands(instruction, &srcA, &srcB, &dest);
+    // Fetch hits are pipelined; only the part of a fetch miss beyond a hit stalls
+    long long fetched = lastReady - hitLatency > cycle ? lastReady - hitLatency : cycle;
+    fetchStalls += fetched - cycle;
+    issueCycle = fetched;
+    if (srcA > 0 && regReady[srcA] > issueCycle)
+    {
+        issueCycle = regReady[srcA];
+    }
+    if (srcB > 0 && regReady[srcB] > issueCycle)
+    {
+        issueCycle = regReady[srcB];
+    }
+    operandStalls += issueCycle - fetched;
+}
+
+// Timing mode: after execution, note when the result is ready and move on
+static void timingComplete(int instruction)
+{
+    int srcA, srcB, dest;
+    getOperands(instruction, &srcA, &srcB, &dest);
+    if (dest > 0)
+    {
+        regReady[dest] = getOpcode(instruction) == 2 ? lastReady : issueCycle + 1;
+    }
+    cycle = issueCycle + 1;
+}
+/*
+ * Cycles each stage of the instruction after stageStart's takes to enter
+ * them, given the cycles its stages are busy for and, if operands is set,
+ * when its operands can be forwarded
+ */
+static void pipelineSchedule(const long long *busy, int srcA, int srcB, bool operands, long long *start)
+{
+    start[stageIF] = stageStart[stageID] > redirectAt ? stageStart[stageID] : redirectAt;
+    for (int stage = stageID; stage <= NUMSTAGES; stage++)
+    {
+        // Done with the last stage, and the instruction ahead has moved on
+        start[stage] = start[stage - 1] + busy[stage - 1];
+        if (stage < NUMSTAGES && stageStart[stage + 1] > start[stage])
+        {
+            start[stage] = stageStart[stage + 1];
+        }
+        if (stage == stageEX && operands)
+        {
+            if (srcA > 0 && forwardReady[srcA] > start[stage])
+            {
+                start[stage] = forwardReady[srcA];
+            }
+            if (srcB > 0 && forwardReady[srcB] > start[stage])
+            {
+                start[stage] = forwardReady[srcB];
+            }
+        }
+    }
+}
+
+/*
+ * Pipelined timing mode: move the instruction at pc, which has just
+ * executed, through the pipeline. fetchCycles and dataCycles are what its
+ * fetch and its lw, sw or cache maintenance took in the cache.
+ */
+static void pipelineAdvance(int instruction, int pc, long long fetchCycles, long long dataCycles)
+{
+    int srcA, srcB, dest;
+    getOperands(instruction, &srcA, &srcB, &dest);
+    int opcode = getOpcode(instruction);
+    bool accessesData = opcode == 2 || opcode == 3 || isCacheMaintenance(instruction);
+    long long busy[NUMSTAGES] = {fetchCycles > 1 ? fetchCycles : 1, 1, 1,
+                                 accessesData && dataCycles > 1 ? dataCycles : 1, 1};
+    fetchMissCycles += busy[stageIF] - 1;
+    memoryMissCycles += busy[stageMEM] - 1;
+
+    // Load-use stalls are what waiting for operands adds to the retirement
+    long long start[NUMSTAGES + 1];
+    pipelineSchedule(busy, srcA, srcB, false, start);
+    long long unstalled = start[NUMSTAGES];
+    pipelineSchedule(busy, srcA, srcB, true, start);
+    loadUseStalls += start[NUMSTAGES] - unstalled;
+    memcpy(stageStart, start, sizeof(stageStart));
+
+    if (dest > 0)
+    {
+        forwardReady[dest] = opcode == 2 ? start[stageWB] : start[stageMEM];
+    }
+    if (opcode == 4)
+    {
+        bool taken = machine->reg[getRegA(instruction)] == machine->reg[getRegB(instruction)];
+        unsigned char *counter = &bht[pc % bhtEntries];
+        bool predictTaken = twoBitPredictor && *counter >= 2;
+        branches++;
+        // A taken beq to pc + 1 goes where not taken would
+        if (predictTaken != taken && getOffset(instruction) != 0)
+        {
+            mispredictions++;
+            redirectAt = start[stageWB];
+            redirectCycles += redirectAt - start[stageID];
+        }
+        if (taken && *counter < 3)
+        {
+            (*counter)++;
+        }
+        else if (!taken && *counter > 0)
+        {
+            (*counter)--;
+        }
+    }
+    else if (opcode == 5)
+    {
+        jumps++;
+        redirectAt = start[stageMEM];
+        redirectCycles += redirectAt - start[stageID];
+    }
+}
+
+static void printPipelineStats(void)
+{
+    long long cycles = stageStart[NUMSTAGES];
+    printf("pipeline: %lld cycles, %d instructions, CPI %.3f\n", cycles, num_instructions,
+           num_instructions ? (double)cycles / num_instructions : 0.0);
+    printf("pipeline: %lld beqs predicted %s, %lld mispredicted, %lld jalrs, %lld cycles refetching\n",
+           branches, twoBitPredictor ? "by 2-bit counters" : "not taken", mispredictions, jumps, redirectCycles);
+    printf("pipeline: %lld load-use stall cycles; cache accesses beyond a cycle kept IF busy %lld cycles and MEM %lld\n",
+           loadUseStalls, fetchMissCycles, memoryMissCycles);
+    if (pageSize)
+    {
+        printf("pipeline: %lld of those cycles on address translation\n", translationStalls);
+    }
+}
+
 int mem_access(int addr, int write_flag, int write_data)
 {
+    // Addresses past the first memory belong to later tenants
+    stateType *memory = tenants[addr / MEMORYSIZE].state;
+    addr %= MEMORYSIZE;
     ++num_mem_accesses;
     if (write_flag)
     {
-        state.mem[addr] = write_data;
-        if (state.numMemory <= addr)
+        memory->mem[addr] = write_data;
+        // Page tables are not part of the program's memory
+        if (memory->numMemory <= addr && addr < pageTableBase)
         {
-            state.numMemory = addr + 1;
+            memory->numMemory = addr + 1;
         }
     }
-    return state.mem[addr];
+    return memory->mem[addr];
 }
 int get_num_mem_accesses()
 {
     return num_mem_accesses;
 }
 
-int main(int argc, char **argv)
+/*
+ * Save the machine and the cache to path. Only the used part of memory is
+ * written, so checkpoints are about as big as the program plus the cache.
+ */
+static void saveCheckpoint(const char *path)
 {
-    char line[MAXLINELENGTH];
-    FILE *filePtr;
-
-    // Initialize everything to 0
-    state.pc = 0;
-    state.numMemory = 0;
-    for (int i = 0; i < NUMREGS; i++)
+    FILE *out = fopen(path, "wb");
+    if (out == NULL)
     {
-        state.reg[i] = 0;
+        printf("error: can't open checkpoint file %s\n", path);
+        exit(1);
+    }
+    int header[6] = {CHECKPOINT_MAGIC, CHECKPOINT_VERSION, state.pc, state.numMemory,
+                     num_instructions, num_mem_accesses};
+    if (fwrite(header, sizeof(int), 6, out) != 6 ||
+        fwrite(state.reg, sizeof(int), NUMREGS, out) != NUMREGS ||
+        fwrite(state.mem, sizeof(int), state.numMemory, out) != (size_t)state.numMemory)
+    {
+        printf("error: failed to write checkpoint file %s\n", path);
+        exit(1);
     }
+    cache_checkpoint_save(out);
+    fclose(out);
+    checkpointWritten = true;
+}
 
-    if (argc != 2)
+// Replace the machine and the cache with the checkpoint at path
+static void restoreCheckpoint(const char *path)
+{
+    FILE *in = fopen(path, "rb");
+    if (in == NULL)
     {
-        printf("error: usage: %s <machine-code file>\n", argv[0]);
+        printf("error: can't open checkpoint file %s\n", path);
+        exit(1);
     }
+    int header[6];
+    if (fread(header, sizeof(int), 6, in) != 6 || header[0] != CHECKPOINT_MAGIC ||
+        header[1] != CHECKPOINT_VERSION || header[3] < 0 || header[3] > MEMORYSIZE)
+    {
+        printf("error: %s is not a version %d checkpoint\n", path, CHECKPOINT_VERSION);
+        exit(1);
+    }
+    state.pc = header[2];
+    state.numMemory = header[3];
+    num_instructions = header[4];
+    num_mem_accesses = header[5];
+    memset(state.mem, 0, sizeof(state.mem));
+    if (fread(state.reg, sizeof(int), NUMREGS, in) != NUMREGS ||
+        fread(state.mem, sizeof(int), state.numMemory, in) != (size_t)state.numMemory)
+    {
+        printf("error: truncated checkpoint file %s\n", path);
+        exit(1);
+    }
+    cache_checkpoint_load(in);
+    fclose(in);
+}
 
-    filePtr = fopen(argv[1], "r");
+/*
+ * Read a machine-code file into s, printing every word if print is set.
+ */
+static void loadProgram(stateType *s, const char *path, bool print)
+{
+    char line[MAXLINELENGTH];
+    FILE *filePtr = fopen(path, "r");
     if (filePtr == NULL)
     {
-        printf("error: can't open file %s, please ensure you are providing the correct path\n", argv[1]);
+        printf("error: can't open file %s, please ensure you are providing the correct path\n", path);
         perror("fopen");
         exit(2);
     }
@@ -94,146 +747,398 @@ int main(int argc, char **argv)
     /* read the entire machine-code file into memory */
     while (fgets(line, MAXLINELENGTH, filePtr) != NULL)
     {
-        if (state.numMemory >= MEMORYSIZE)
+        if (s->numMemory >= MEMORYSIZE)
         {
             fprintf(stderr, "Error: Exceeded memory size while loading machine code.\n");
             exit(2);
         }
-        if (sscanf(line, "%x", &state.mem[state.numMemory]) != 1)
+        if (sscanf(line, "%x", &s->mem[s->numMemory]) != 1)
         {
-            fprintf(stderr, "Error: Invalid machine code at address %d: %s", state.numMemory, line);
+            fprintf(stderr, "Error: Invalid machine code at address %d: %s", s->numMemory, line);
             exit(2);
         }
-        printf("memory[%d]=0x%08X\n", state.numMemory, state.mem[state.numMemory]);
-        state.numMemory++;
-    }
-
-    fclose(filePtr);
-
-    bool halt = false;
-
-    // Simulation loop
-    while (!halt)
-    {
-        // Checks if the PC is in bound
-        if (state.pc < 0 || state.pc >= state.numMemory)
+        if (print)
         {
-            fprintf(stderr, "Error: PC out of bounds (%d)\n", state.pc);
+            printf("memory[%d]=0x%x\n", s->numMemory, s->mem[s->numMemory]);
         }
-
-        printState(&state);
-
-        int instruction = state.mem[state.pc];
-
-        executeInstruction(&state, instruction, &halt);
+        s->numMemory++;
     }
 
-    printState(&state);
-
-    return 0;
+    fclose(filePtr);
 }
 
-// Executes a single instruction
-void executeInstruction(stateType *state, int instruction, bool *halt)
+// Park the running core's pc and registers and resume core next
+static void switchCore(int next)
 {
-    int opcode = getOpcode(instruction);
-    int regA, regB, destReg, offset;
+    cores[currentCore].pc = state.pc;
+    memcpy(cores[currentCore].reg, state.reg, sizeof(state.reg));
+    currentCore = next;
+    state.pc = cores[currentCore].pc;
+    memcpy(state.reg, cores[currentCore].reg, sizeof(state.reg));
+}
 
-    // Implement a switch-case structure to handle each opcode
-    switch (opcode)
+int main(int argc, char **argv)
+{
+    // Initialize everything to 0
+    state.pc = 0;
+    state.numMemory = 0;
+    for (int i = 0; i < NUMREGS; i++)
     {
-    case 0: // add
-        regA = getRegA(instruction);
-        regB = getRegB(instruction);
-        destReg = getDestReg(instruction);
-        state->reg[destReg] = state->reg[regA] + state->reg[regB];
-        state->pc++;
-        break;
+        state.reg[i] = 0;
+    }
 
-    case 1: // nor
-        regA = getRegA(instruction);
-        regB = getRegB(instruction);
-        destReg = getDestReg(instruction);
-        state->reg[destReg] = ~(state->reg[regA] | state->reg[regB]);
-        state->pc++;
-        break;
+    if (argc < 5)
+    {
+        printf("error: usage: %s <machine-code file> <line size in words> <number of sets> <lines per set> [option=value ...]\n", argv[0]);
+        exit(1);
+    }
 
-    case 2: // lw
+    // Anything after the cache geometry is a name=value option, either for
+    // checkpointing or for the cache
+    for (int i = 5; i < argc; i++)
     {
-        regA = getRegA(instruction);
-        regB = getRegB(instruction);
-        offset = getOffset(instruction);
+        char name[MAXLINELENGTH];
+        char *equals = strchr(argv[i], '=');
+        if (equals == NULL || equals - argv[i] >= MAXLINELENGTH)
+        {
+            printf("error: options must look like name=value, got %s\n", argv[i]);
+            exit(1);
+        }
+        memcpy(name, argv[i], equals - argv[i]);
+        name[equals - argv[i]] = '\0';
+        if (!strcmp(name, "checkpoint"))
+        {
+            checkpointFile = equals + 1;
+        }
+        else if (!strcmp(name, "checkpoint-at"))
+        {
+            checkpointAt = atoi(equals + 1);
+        }
+        else if (!strcmp(name, "restore"))
+        {
+            restoreFile = equals + 1;
+        }
+        else if (!strcmp(name, "trace"))
+        {
+            traceFile = equals + 1;
+        }
+        else if (!strcmp(name, "mshrs") || !strcmp(name, "hit-latency"))
+        {
+            // Both are cache options, but the timing front end needs them too
+            if (!strcmp(name, "mshrs"))
+            {
+                timing = atoi(equals + 1) > 0;
+            }
+            else
+            {
+                hitLatency = atoi(equals + 1);
+            }
+            cache_set_option(name, equals + 1);
+        }
+        else if (!strcmp(name, "pipeline"))
+        {
+            pipelining = atoi(equals + 1) > 0;
+        }
+        else if (!strcmp(name, "branch-predict"))
+        {
+            if (strcmp(equals + 1, "not-taken") && strcmp(equals + 1, "2bit"))
+            {
+                printf("error: branch-predict must be not-taken or 2bit\n");
+                exit(1);
+            }
+            twoBitPredictor = !strcmp(equals + 1, "2bit");
+        }
+        else if (!strcmp(name, "bht-entries"))
+        {
+            bhtEntries = atoi(equals + 1);
+            if (bhtEntries < 1 || bhtEntries > MAXBHTENTRIES)
+            {
+                printf("error: bht-entries must be between 1 and %d\n", MAXBHTENTRIES);
+                exit(1);
+            }
+        }
+        else if (!strcmp(name, "page-size"))
+        {
+            pageSize = atoi(equals + 1);
+        }
+        else if (!strcmp(name, "page-levels"))
+        {
+            pageLevels = atoi(equals + 1);
+        }
+        else if (!strcmp(name, "tlb"))
+        {
+            tlb1.size = atoi(equals + 1);
+        }
+        else if (!strcmp(name, "tlb2"))
+        {
+            tlb2.size = atoi(equals + 1);
+        }
+        else if (!strcmp(name, "indexing"))
+        {
+            if (strcmp(equals + 1, "pipt") && strcmp(equals + 1, "vipt"))
+            {
+                printf("error: indexing must be pipt or vipt\n");
+                exit(1);
+            }
+            vipt = !strcmp(equals + 1, "vipt");
+        }
+        else if (!strcmp(name, "corun"))
+        {
+            // Every file in the comma-separated list becomes another tenant
+            char *file = equals + 1;
+            while (*file)
+            {
+                if (numTenants == MAXTENANTS)
+                {
+                    printf("error: at most %d programs can share the cache\n", MAXTENANTS);
+                    exit(1);
+                }
+                char *comma = strchr(file, ',');
+                if (comma != NULL)
+                {
+                    *comma = '\0';
+                }
+                tenants[numTenants++].file = file;
+                file = comma != NULL ? comma + 1 : file + strlen(file);
+            }
+            char count[16];
+            sprintf(count, "%d", numTenants);
+            cache_set_option("tenants", count);
+        }
+        else if (!strcmp(name, "cores"))
+        {
+            // The cache needs to know too, to give each core its own cache
+            numCores = atoi(equals + 1);
+            if (numCores < 1 || numCores > MAXCORES)
+            {
+                printf("error: cores must be between 1 and %d\n", MAXCORES);
+                exit(1);
+            }
+            cache_set_option(name, equals + 1);
+        }
+        else if (cache_set_option(name, equals + 1) != 0)
+        {
+            printf("error: unknown option %s\n", name);
+            exit(1);
+        }
+    }
 
-        int effectiveAddress = state->reg[regA] + offset;
+    cache_init(atoi(argv[2]), atoi(argv[3]), atoi(argv[4]));
 
-        // Check if the new address is out of range
-        if (effectiveAddress < 0 || effectiveAddress >= MEMORYSIZE)
+    loadProgram(&state, argv[1], true);
+    printf("\n");
+    tenants[0].file = argv[1];
+    for (int t = 1; t < numTenants; t++)
+    {
+        tenants[t].state = calloc(1, sizeof(stateType));
+        if (tenants[t].state == NULL)
         {
-            fprintf(stderr, "Error: Memory access out of bounds at PC %d (Effective Address: %d)\n", state->pc, effectiveAddress);
+            printf("error: out of memory for tenant %d\n", t);
+            exit(1);
         }
-
-        state->reg[regB] = state->mem[effectiveAddress];
-        state->pc++;
-        break;
+        loadProgram(tenants[t].state, tenants[t].file, false);
+        printf("tenant %d: loaded %d words from %s\n", t, tenants[t].state->numMemory, tenants[t].file);
     }
 
-    case 3: // sw
+    if ((checkpointFile == NULL) != (checkpointAt < 0))
+    {
+        printf("error: checkpoint and checkpoint-at must be given together\n");
+        exit(1);
+    }
+    if (numCores > 1 && (checkpointFile != NULL || restoreFile != NULL))
+    {
+        printf("error: checkpoints are not supported with more than one core\n");
+        exit(1);
+    }
+    if (timing && (checkpointFile != NULL || restoreFile != NULL))
+    {
+        printf("error: checkpoints are not supported with mshrs\n");
+        exit(1);
+    }
+    if (pipelining && (timing || numCores > 1 || numTenants > 1 || checkpointFile != NULL || restoreFile != NULL))
+    {
+        printf("error: pipeline can't be combined with mshrs, cores, corun or checkpoints\n");
+        exit(1);
+    }
+    if (numTenants > 1 && (numCores > 1 || timing || traceFile != NULL ||
+                           checkpointFile != NULL || restoreFile != NULL))
+    {
+        printf("error: corun can't be combined with cores, mshrs, trace or checkpoints\n");
+        exit(1);
+    }
+    if (pageSize && (checkpointFile != NULL || restoreFile != NULL))
+    {
+        printf("error: checkpoints are not supported with page-size\n");
+        exit(1);
+    }
+    if (pageSize)
     {
-        regA = getRegA(instruction);
-        regB = getRegB(instruction);
-        offset = getOffset(instruction);
+        initPaging(atoi(argv[2]), atoi(argv[3]));
+    }
+    if (restoreFile != NULL)
+    {
+        restoreCheckpoint(restoreFile);
+    }
+    if (traceFile != NULL)
+    {
+        trace_open_write(traceFile);
+    }
 
-        int effectiveAddress = state->reg[regA] + offset;
+    // Simulation loop. Every core runs the loaded program on the shared
+    // memory, starting at pc 0 with zeroed registers. Tenants run their
+    // own programs on their own memories.
+    int running = numCores * numTenants;
+    while (running > 0)
+    {
+        if (num_instructions == checkpointAt)
+        {
+            saveCheckpoint(checkpointFile);
+        }
 
-        // Check if the new address is out of range
-        if (effectiveAddress < 0 || effectiveAddress >= MEMORYSIZE)
+        // Checks if the PC is in bound
+        if (machine->pc < 0 || machine->pc >= machine->numMemory)
         {
-            fprintf(stderr, "Error: Memory access out of bounds at PC %d (Effective Address: %d)\n", state->pc, effectiveAddress);
+            fprintf(stderr, "Error: PC out of bounds (%d)\n", machine->pc);
+            exit(1);
         }
 
-        state->mem[effectiveAddress] = state->reg[regB];
-        state->pc++;
-        break;
-    }
+        // Instruction fetch goes through the cache
+        int pc = machine->pc;
+        accessCycles = 0;
+        int instruction = memoryAccess(TRACE_FETCH, machine->pc, machine->pc, 0);
+        long long fetchCycles = accessCycles;
 
-    case 4: // beq
-        regA = getRegA(instruction);
-        regB = getRegB(instruction);
-        offset = getOffset(instruction);
+        bool halt = false;
+        if (timing)
+        {
+            timingIssue(instruction);
+        }
+        accessCycles = 0;
+        executeInstruction(machine, instruction, &halt);
+        if (timing)
+        {
+            timingComplete(instruction);
+        }
+        if (pipelining)
+        {
+            pipelineAdvance(instruction, pc, fetchCycles, accessCycles);
+        }
+        num_instructions++;
+        cache_instruction();
+        cores[currentCore].instructions++;
+        tenants[currentTenant].instructions++;
+        if (halt)
+        {
+            cores[currentCore].halted = true;
+            tenants[currentTenant].halted = true;
+            running--;
+        }
 
-        if (state->reg[regA] == state->reg[regB])
+        if (numCores > 1 && running > 0)
         {
-            state->pc = state->pc + 1 + offset;
+            int next = (currentCore + 1) % numCores;
+            while (cores[next].halted)
+            {
+                next = (next + 1) % numCores;
+            }
+            switchCore(next);
         }
-        else
+        if (numTenants > 1 && running > 0)
         {
-            state->pc++;
+            do
+            {
+                currentTenant = (currentTenant + 1) % numTenants;
+            } while (tenants[currentTenant].halted);
+            machine = tenants[currentTenant].state;
         }
-        break;
+    }
 
-    case 5: // jalr
-        regA = getRegA(instruction);
-        regB = getRegB(instruction);
-        state->reg[regB] = state->pc + 1;
-        state->pc = state->reg[regA];
-        break;
+    // A checkpoint past the end of the program would silently never be written
+    if (checkpointFile != NULL && !checkpointWritten)
+    {
+        printf("error: the program halted after %d instructions, before checkpoint-at=%d\n",
+               num_instructions, checkpointAt);
+        exit(1);
+    }
 
-    case 6: // halt
-        *halt = true;
-        state->pc++;
-        break;
+    cache_final_flush();
+    printf("machine halted\n");
+    printf("total of %d instructions executed\n", num_instructions);
+    if (numCores == 1 && numTenants == 1)
+    {
+        printf("final state of machine:\n");
+        printState(&state);
+    }
+    for (int t = 0; numTenants > 1 && t < numTenants; t++)
+    {
+        printf("final state of tenant %d, %s (%d instructions executed):\n",
+               t, tenants[t].file, tenants[t].instructions);
+        printState(tenants[t].state);
+    }
+    for (int core = 0; numCores > 1 && core < numCores; core++)
+    {
+        switchCore(core);
+        printf("final state of core %d (%d instructions executed):\n", core, cores[core].instructions);
+        printState(&state);
+    }
+    printf("$$$ Main memory words accessed: %d\n", get_num_mem_accesses());
+    printStats();
+    if (timing)
+    {
+        printf("timing: %lld cycles, CPI %.3f\n", cycle, num_instructions ? (double)cycle / num_instructions : 0.0);
+        printf("timing: stall cycles %lld on fetch misses, %lld waiting for operands, %lld on full MSHRs\n",
+               fetchStalls, operandStalls, mshrStalls);
+        if (pageSize)
+        {
+            printf("timing: %lld stall cycles on address translation\n", translationStalls);
+        }
+    }
+    if (pipelining)
+    {
+        printPipelineStats();
+    }
+    if (pageSize)
+    {
+        printPagingStats();
+    }
+    if (traceFile != NULL)
+    {
+        trace_close_write();
+    }
 
-    case 7: // noop
-        state->pc++;
-        break;
+    return 0;
+}
 
-    default:
-        // Handle unknown opcode
-        fprintf(stderr, "Error: Unknown opcode %d at address %d\n", opcode, state->pc);
+// lw and sw go through the cache, after a bounds check
+static void checkAddress(int pc, int addr)
+{
+    if (addr < 0 || addr >= MEMORYSIZE)
+    {
+        fprintf(stderr, "Error: Memory access out of bounds at PC %d (Effective Address: %d)\n", pc, addr);
+        exit(1);
     }
+}
 
-    // Ensure register 0 is always 0
-    state->reg[0] = 0;
+static int loadWord(int pc, int addr, int *value)
+{
+    checkAddress(pc, addr);
+    *value = memoryAccess(TRACE_LOAD, pc, addr, 0);
+    return 0;
+}
+
+static int storeWord(int pc, int addr, int value)
+{
+    checkAddress(pc, addr);
+    memoryAccess(TRACE_STORE, pc, addr, value);
+    return 0;
+}
+
+static const lc2kPorts memoryPorts = {loadWord, storeWord, maintainCache};
+
+// Executes a single instruction, see lc2k.c
+void executeInstruction(stateType *state, int instruction, bool *halt)
+{
+    *halt = lc2k_execute(&state->pc, state->reg, instruction, &memoryPorts) == lc2kHalted;
 }
 
 /*
@@ -0,0 +1,241 @@
+/*
+ * Reference cache model for verify=1
+ * A deliberately plain write-back, write-allocate LRU cache with no data
+ * and no instrumentation, checked against cache.c after every access: hit
+ * or miss, the way a miss fills, whether the victim is written back, and
+ * the data a read returns. Memory is modelled flat: the first read of a
+ * word teaches it the word's value, and every later read must return the
+ * last value written or learned.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_CACHE_SIZE 256
+#define MAX_ADDRESS 65536
+
+// Reports a bad option or configuration and stops, see cache.c
+extern void cache_error(const char *format, ...) __attribute__((noreturn));
+
+// One way of the reference cache; lastUse orders the ways of a set by recency
+typedef struct oracleWay
+{
+    int valid;
+    int dirty;
+    int tag;
+    long long lastUse;
+} oracleWay;
+
+static int blockSize;
+static int numSets;
+static int blocksPerSet;
+static oracleWay ways[MAX_CACHE_SIZE];
+static int known[MAX_ADDRESS];
+static int values[MAX_ADDRESS];
+static long long accesses;
+
+// Empty the reference cache and forget memory
+void oracle_init(int bs, int ns, int bps)
+{
+    blockSize = bs;
+    numSets = ns;
+    blocksPerSet = bps;
+    memset(ways, 0, sizeof(ways));
+    memset(known, 0, sizeof(known));
+    accesses = 0;
+}
+
+static void describe(char *out, int hit, int way, int writeback)
+{
+    if (hit)
+    {
+        sprintf(out, "hit in way %d", way);
+    }
+    else
+    {
+        sprintf(out, "miss filling way %d%s", way, writeback ? " after a writeback" : "");
+    }
+}
+
+static void print_set(int set)
+{
+    printf("verify: reference set %d:", set);
+    for (int way = 0; way < blocksPerSet; way++)
+    {
+        oracleWay *w = &ways[set * blocksPerSet + way];
+        if (w->valid)
+        {
+            printf(" [%d: T:%d%s used %lld]", way, w->tag, w->dirty ? " dirty" : "", w->lastUse);
+        }
+        else
+        {
+            printf(" [%d: invalid]", way);
+        }
+    }
+    printf("\n");
+}
+
+/*
+ * Run one access through the reference model and compare it with what the
+ * cache did: whether it hit, the way it hit or filled, whether it wrote a
+ * victim back and, for reads, the result. Returns 0 if they agree;
+ * otherwise describes the divergence and returns -1.
+ */
+int oracle_check(int addr, int write_flag, int write_data, int result, int hit, int way, int writeback)
+{
+    accesses++;
+    if (addr < 0 || addr >= MAX_ADDRESS)
+    {
+        printf("verify: access %lld is to address %d, outside of memory\n", accesses, addr);
+        return -1;
+    }
+    int set = (addr / blockSize) % numSets;
+    int tag = addr / (blockSize * numSets);
+    oracleWay *first = &ways[set * blocksPerSet];
+    int expectedWay = -1;
+    int expectedHit = 0;
+    int expectedWriteback = 0;
+
+    for (int i = 0; i < blocksPerSet; i++)
+    {
+        if (first[i].valid && first[i].tag == tag)
+        {
+            expectedWay = i;
+            expectedHit = 1;
+        }
+    }
+    for (int i = 0; expectedWay == -1 && i < blocksPerSet; i++)
+    {
+        if (!first[i].valid)
+        {
+            expectedWay = i;
+        }
+    }
+    if (expectedWay == -1)
+    {
+        expectedWay = 0;
+        for (int i = 1; i < blocksPerSet; i++)
+        {
+            if (first[i].lastUse < first[expectedWay].lastUse)
+            {
+                expectedWay = i;
+            }
+        }
+    }
+    if (!expectedHit)
+    {
+        expectedWriteback = first[expectedWay].valid && first[expectedWay].dirty;
+    }
+
+    int expectedResult = result;
+    if (!write_flag && known[addr])
+    {
+        expectedResult = values[addr];
+    }
+
+    if (hit != expectedHit || way != expectedWay || writeback != expectedWriteback ||
+        result != expectedResult)
+    {
+        char cacheSaw[64];
+        char referenceSaw[64];
+        describe(cacheSaw, hit, way, writeback);
+        describe(referenceSaw, expectedHit, expectedWay, expectedWriteback);
+        printf("verify: access %lld (%s of address %d) diverged from the reference model\n",
+               accesses, write_flag ? "write" : "read", addr);
+        printf("verify: cache %s", cacheSaw);
+        if (!write_flag)
+        {
+            printf(", returned 0x%08X", result);
+        }
+        printf("; reference %s", referenceSaw);
+        if (!write_flag)
+        {
+            printf(", expected 0x%08X", expectedResult);
+        }
+        printf("\n");
+        print_set(set);
+        return -1;
+    }
+
+    oracleWay *w = &first[expectedWay];
+    if (!expectedHit)
+    {
+        w->valid = 1;
+        w->dirty = 0;
+        w->tag = tag;
+    }
+    w->lastUse = accesses;
+    w->dirty |= write_flag;
+    known[addr] = 1;
+    values[addr] = write_flag ? write_data : result;
+    return 0;
+}
+
+// The reference way holding addr's block, or NULL if it isn't cached
+static oracleWay *find_way(int addr)
+{
+    int set = (addr / blockSize) % numSets;
+    int tag = addr / (blockSize * numSets);
+    for (int i = 0; i < blocksPerSet; i++)
+    {
+        oracleWay *w = &ways[set * blocksPerSet + i];
+        if (w->valid && w->tag == tag)
+        {
+            return w;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Follow a cache maintenance operation on the block at addr: cleaning
+ * leaves it clean, invalidating drops it. Invalidating a dirty block
+ * without writing it back loses its writes, so its words have to be
+ * learned from memory again.
+ */
+void oracle_maintain(int addr, int invalidate, int written_back)
+{
+    oracleWay *w = addr >= 0 && addr < MAX_ADDRESS ? find_way(addr) : NULL;
+    if (w == NULL)
+    {
+        return;
+    }
+    if (w->dirty && !written_back)
+    {
+        int base = addr - addr % blockSize;
+        memset(&known[base], 0, blockSize * sizeof(int));
+    }
+    w->dirty = 0;
+    w->valid = !invalidate;
+}
+
+/*
+ * Append the reference cache and the memory it has learned to a
+ * checkpoint, so a restored run is still checked against the same model
+ */
+void oracle_checkpoint_save(FILE *out)
+{
+    if (fwrite(ways, sizeof(oracleWay), numSets * blocksPerSet, out) != (size_t)(numSets * blocksPerSet) ||
+        fwrite(known, sizeof(int), MAX_ADDRESS, out) != MAX_ADDRESS ||
+        fwrite(values, sizeof(int), MAX_ADDRESS, out) != MAX_ADDRESS || fwrite(&accesses, sizeof(long long), 1, out) != 1)
+    {
+        cache_error("failed to write the reference model to the checkpoint");
+    }
+}
+
+// Read what oracle_checkpoint_save wrote; oracle_init must already have run
+void oracle_checkpoint_load(FILE *in)
+{
+    if (fread(ways, sizeof(oracleWay), numSets * blocksPerSet, in) != (size_t)(numSets * blocksPerSet) ||
+        fread(known, sizeof(int), MAX_ADDRESS, in) != MAX_ADDRESS ||
+        fread(values, sizeof(int), MAX_ADDRESS, in) != MAX_ADDRESS || fread(&accesses, sizeof(long long), 1, in) != 1)
+    {
+        cache_error("truncated reference model checkpoint");
+    }
+}
+
+void oracle_print_stats(void)
+{
+    printf("verify: %lld accesses matched the reference model\n", accesses);
+}
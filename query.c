@@ -0,0 +1,514 @@
+/*
+ * Query tool for results stores written by sweep results=<file>
+ *     ./query <results file> <command> [arguments] [filters]
+ * Commands:
+ *  -    list [column,...]: the matching runs as CSV, every column by default
+ *  -    summary <metric> <column>: count, min, mean and max of metric over
+ *                    the matching runs with each value of column
+ *  -    pareto <x> <y>: the matching runs no other matching run beats on
+ *                    both x and y, lower being better, by increasing x
+ *  -    intervals [column,...]: the intervals of the matching runs as CSV
+ * summary and pareto leave out runs that failed, whose statistics are
+ * incomplete.
+ * Filters keep the runs whose column compares to value as given, with
+ * column=value, !=, <, <=, > or >=. Numbers compare as numbers, and so do
+ * text values when both sides are numbers.
+ * Besides the stored columns, every run has size, its cache's data words
+ * (blockSize * numSets * blocksPerSet), and missRate.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "results.h"
+
+#define MAX_FILTERS 64
+#define MAX_COLUMNS 128
+#define MAXLINELENGTH 1000
+
+// Columns every run has without them being stored, numbered after the stored ones
+enum derivedColumn
+{
+    derivedSize,
+    derivedMissRate,
+    NUM_DERIVED
+};
+
+static const char *derivedNames[NUM_DERIVED] = {"size", "missRate"};
+
+enum comparison
+{
+    compareEqual,
+    compareNotEqual,
+    compareLess,
+    compareLessOrEqual,
+    compareGreater,
+    compareGreaterOrEqual
+};
+
+// Operators, longest first so <= isn't read as <
+static const char *comparisonNames[] = {"!=", "<=", ">=", "=", "<", ">"};
+static const enum comparison comparisonKinds[] = {compareNotEqual, compareLessOrEqual, compareGreaterOrEqual,
+                                                  compareEqual, compareLess, compareGreater};
+
+typedef struct filter
+{
+    int column;
+    enum comparison comparison;
+    const char *value;
+    // For text columns, whether each dictionary entry passes
+    char *passes;
+} filter;
+
+static resultsTable runs;
+static resultsTable intervals;
+static filter filters[MAX_FILTERS];
+static int numFilters = 0;
+static int blockSizeColumn, numSetsColumn, blocksPerSetColumn, hitsColumn, missesColumn, statusColumn;
+// The status column's dictionary entry for runs that halted, -1 if none did
+static long long haltedStatus = -1;
+
+static void usage(const char *program)
+{
+    printf("error: usage: %s <results file> list [column,...] | summary <metric> <column> | "
+           "pareto <x> <y> | intervals [column,...], then filters like column<=value\n",
+           program);
+    exit(1);
+}
+
+// Index of a run column, stored or derived; exits if there is none
+static int run_column(const char *name)
+{
+    int column = results_column(&runs, name);
+    for (int d = 0; column == -1 && d < NUM_DERIVED; d++)
+    {
+        if (!strcmp(name, derivedNames[d]))
+        {
+            column = runs.numColumns + d;
+        }
+    }
+    if (column == -1)
+    {
+        printf("error: no column %s\n", name);
+        exit(1);
+    }
+    return column;
+}
+
+static int is_text(int column)
+{
+    return column < runs.numColumns && runs.columns[column].type == resultsText;
+}
+
+static const char *column_name(int column)
+{
+    return column < runs.numColumns ? runs.columns[column].name : derivedNames[column - runs.numColumns];
+}
+
+// A run's value in a number or derived column
+static double run_number(int column, int row)
+{
+    if (column < runs.numColumns)
+    {
+        return runs.columns[column].values[row];
+    }
+    if (column == runs.numColumns + derivedSize)
+    {
+        return (double)runs.columns[blockSizeColumn].values[row] * runs.columns[numSetsColumn].values[row] *
+               runs.columns[blocksPerSetColumn].values[row];
+    }
+    long long hits = runs.columns[hitsColumn].values[row];
+    long long misses = runs.columns[missesColumn].values[row];
+    return hits + misses ? (double)misses / (hits + misses) : 0.0;
+}
+
+static void print_run_value(int column, int row)
+{
+    if (is_text(column))
+    {
+        printf("%s", results_text(&runs, column, row));
+    }
+    else if (column == runs.numColumns + derivedMissRate)
+    {
+        printf("%.6f", run_number(column, row));
+    }
+    else
+    {
+        printf("%.0f", run_number(column, row));
+    }
+}
+
+// Whether a and b compare as the comparison asks, as numbers if they both are
+static int compare_text(const char *a, enum comparison comparison, const char *b)
+{
+    char *endA, *endB;
+    double x = strtod(a, &endA);
+    double y = strtod(b, &endB);
+    int order = *a && *b && !*endA && !*endB ? (x > y) - (x < y) : strcmp(a, b);
+    switch (comparison)
+    {
+    case compareEqual:
+        return order == 0;
+    case compareNotEqual:
+        return order != 0;
+    case compareLess:
+        return order < 0;
+    case compareLessOrEqual:
+        return order <= 0;
+    case compareGreater:
+        return order > 0;
+    default:
+        return order >= 0;
+    }
+}
+
+static void add_filter(const char *arg)
+{
+    if (numFilters == MAX_FILTERS)
+    {
+        printf("error: at most %d filters\n", MAX_FILTERS);
+        exit(1);
+    }
+    // The first operator in the argument, preferring the longer at the same place
+    const char *best = NULL;
+    int kind = 0;
+    for (int k = 0; k < (int)(sizeof(comparisonKinds) / sizeof(comparisonKinds[0])); k++)
+    {
+        const char *at = strstr(arg, comparisonNames[k]);
+        if (at != NULL && (best == NULL || at < best))
+        {
+            best = at;
+            kind = k;
+        }
+    }
+    if (best == NULL || best == arg || best - arg >= MAXLINELENGTH)
+    {
+        printf("error: filters must look like column<=value, got %s\n", arg);
+        exit(1);
+    }
+    char name[MAXLINELENGTH];
+    memcpy(name, arg, best - arg);
+    name[best - arg] = '\0';
+    filter *f = &filters[numFilters++];
+    f->column = run_column(name);
+    f->comparison = comparisonKinds[kind];
+    f->value = best + strlen(comparisonNames[kind]);
+    if (is_text(f->column))
+    {
+        // Decide once per distinct value instead of once per run
+        resultsColumn *column = &runs.columns[f->column];
+        f->passes = malloc(column->dictionarySize ? column->dictionarySize : 1);
+        if (f->passes == NULL)
+        {
+            printf("error: out of memory\n");
+            exit(1);
+        }
+        for (int d = 0; d < column->dictionarySize; d++)
+        {
+            f->passes[d] = compare_text(column->dictionary[d], f->comparison, f->value);
+        }
+    }
+}
+
+static int run_matches(int row)
+{
+    for (int i = 0; i < numFilters; i++)
+    {
+        filter *f = &filters[i];
+        if (f->passes != NULL)
+        {
+            if (!f->passes[runs.columns[f->column].values[row]])
+            {
+                return 0;
+            }
+            continue;
+        }
+        double x = run_number(f->column, row);
+        double y = atof(f->value);
+        int order = (x > y) - (x < y);
+        int passes = f->comparison == compareEqual          ? order == 0
+                     : f->comparison == compareNotEqual     ? order != 0
+                     : f->comparison == compareLess         ? order < 0
+                     : f->comparison == compareLessOrEqual  ? order <= 0
+                     : f->comparison == compareGreater      ? order > 0
+                                                            : order >= 0;
+        if (!passes)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Parse a comma-separated column list with lookup, or take every column there is
+static int parse_columns(const char *list, int (*lookup)(const char *), int all, int *columns)
+{
+    int n = 0;
+    if (list == NULL)
+    {
+        for (; n < all && n < MAX_COLUMNS; n++)
+        {
+            columns[n] = n;
+        }
+        return n;
+    }
+    char buffer[MAXLINELENGTH];
+    snprintf(buffer, MAXLINELENGTH, "%s", list);
+    for (char *name = strtok(buffer, ","); name != NULL && n < MAX_COLUMNS; name = strtok(NULL, ","))
+    {
+        columns[n++] = lookup(name);
+    }
+    return n;
+}
+
+static void list_runs(const char *list)
+{
+    int columns[MAX_COLUMNS];
+    int n = parse_columns(list, run_column, runs.numColumns + NUM_DERIVED, columns);
+    for (int i = 0; i < n; i++)
+    {
+        printf("%s%s", i ? "," : "", column_name(columns[i]));
+    }
+    printf("\n");
+    for (int row = 0; row < runs.rows; row++)
+    {
+        if (run_matches(row))
+        {
+            for (int i = 0; i < n; i++)
+            {
+                printf("%s", i ? "," : "");
+                print_run_value(columns[i], row);
+            }
+            printf("\n");
+        }
+    }
+}
+
+// One run of a summary or Pareto front: what it is ordered by and its metric
+typedef struct point
+{
+    double key;
+    double value;
+    int row;
+} point;
+
+static int by_key_then_value(const void *a, const void *b)
+{
+    const point *p = a;
+    const point *q = b;
+    if (p->key != q->key)
+    {
+        return p->key < q->key ? -1 : 1;
+    }
+    if (p->value != q->value)
+    {
+        return p->value < q->value ? -1 : 1;
+    }
+    return p->row - q->row;
+}
+
+// The matching runs that halted as points of key and value columns, sorted
+static int collect_points(int keyColumn, int valueColumn, point **points)
+{
+    *points = malloc((runs.rows ? runs.rows : 1) * sizeof(point));
+    if (*points == NULL)
+    {
+        printf("error: out of memory\n");
+        exit(1);
+    }
+    int n = 0;
+    for (int row = 0; row < runs.rows; row++)
+    {
+        if (runs.columns[statusColumn].values[row] == haltedStatus && run_matches(row))
+        {
+            // Text keys group by dictionary entry
+            (*points)[n].key = run_number(keyColumn, row);
+            (*points)[n].value = run_number(valueColumn, row);
+            (*points)[n++].row = row;
+        }
+    }
+    qsort(*points, n, sizeof(point), by_key_then_value);
+    return n;
+}
+
+static void summarize(const char *metric, const char *group)
+{
+    int metricColumn = run_column(metric);
+    int groupColumn = run_column(group);
+    if (is_text(metricColumn))
+    {
+        printf("error: %s is not a number\n", metric);
+        exit(1);
+    }
+    point *points;
+    int n = collect_points(groupColumn, metricColumn, &points);
+    printf("%s,runs,min %s,mean %s,max %s\n", group, metric, metric, metric);
+    for (int first = 0; first < n;)
+    {
+        int end = first;
+        double sum = 0;
+        while (end < n && points[end].key == points[first].key)
+        {
+            sum += points[end++].value;
+        }
+        // Points are sorted by value within a group, so the ends are the extremes
+        print_run_value(groupColumn, points[first].row);
+        printf(",%d,%g,%g,%g\n", end - first, points[first].value, sum / (end - first), points[end - 1].value);
+        first = end;
+    }
+    free(points);
+}
+
+static void pareto(const char *x, const char *y)
+{
+    int xColumn = run_column(x);
+    int yColumn = run_column(y);
+    if (is_text(xColumn) || is_text(yColumn))
+    {
+        printf("error: pareto needs two number columns\n");
+        exit(1);
+    }
+    point *points;
+    int n = collect_points(xColumn, yColumn, &points);
+    int columns[MAX_COLUMNS];
+    int numColumns = parse_columns(NULL, NULL, runs.numColumns + NUM_DERIVED, columns);
+    for (int i = 0; i < numColumns; i++)
+    {
+        printf("%s%s", i ? "," : "", column_name(columns[i]));
+    }
+    printf("\n");
+    // By increasing x, a run is on the front if it beats every run before it on y
+    for (int i = 0; i < n; i++)
+    {
+        if (i > 0 && points[i].value >= points[i - 1].value)
+        {
+            // Carry the best y forward, so later runs compare against it
+            points[i].value = points[i - 1].value;
+            continue;
+        }
+        for (int c = 0; c < numColumns; c++)
+        {
+            printf("%s", c ? "," : "");
+            print_run_value(columns[c], points[i].row);
+        }
+        printf("\n");
+    }
+    free(points);
+}
+
+static int interval_column(const char *name)
+{
+    int column = results_column(&intervals, name);
+    if (column == -1)
+    {
+        printf("error: no interval column %s\n", name);
+        exit(1);
+    }
+    return column;
+}
+
+static void list_intervals(const char *list)
+{
+    int columns[MAX_COLUMNS];
+    int n = parse_columns(list, interval_column, intervals.numColumns, columns);
+    int runOf = interval_column("run");
+    for (int i = 0; i < n; i++)
+    {
+        printf("%s%s", i ? "," : "", intervals.columns[columns[i]].name);
+    }
+    printf("\n");
+    // Runs are matched once, not once per interval
+    char *matches = malloc(runs.rows ? runs.rows : 1);
+    if (matches == NULL)
+    {
+        printf("error: out of memory\n");
+        exit(1);
+    }
+    for (int row = 0; row < runs.rows; row++)
+    {
+        matches[row] = run_matches(row);
+    }
+    for (int row = 0; row < intervals.rows; row++)
+    {
+        long long run = intervals.columns[runOf].values[row];
+        if (run < 0 || run >= runs.rows || !matches[run])
+        {
+            continue;
+        }
+        for (int i = 0; i < n; i++)
+        {
+            printf("%s%lld", i ? "," : "", intervals.columns[columns[i]].values[row]);
+        }
+        printf("\n");
+    }
+    free(matches);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        usage(argv[0]);
+    }
+    if (results_load(argv[1], &runs, &intervals) != 0)
+    {
+        printf("error: %s is not a results store\n", argv[1]);
+        exit(1);
+    }
+    blockSizeColumn = run_column("blockSize");
+    numSetsColumn = run_column("numSets");
+    blocksPerSetColumn = run_column("blocksPerSet");
+    hitsColumn = run_column("hits");
+    missesColumn = run_column("misses");
+    statusColumn = run_column("status");
+    for (int d = 0; d < runs.columns[statusColumn].dictionarySize; d++)
+    {
+        if (!strcmp(runs.columns[statusColumn].dictionary[d], "halted"))
+        {
+            haltedStatus = d;
+        }
+    }
+
+    const char *command = argv[2];
+    int arguments = !strcmp(command, "summary") || !strcmp(command, "pareto") ? 2 : 0;
+    if (argc < 3 + arguments)
+    {
+        usage(argv[0]);
+    }
+    // list and intervals take an optional column list, which isn't a filter
+    const char *list = NULL;
+    int next = 3 + arguments;
+    if (!arguments && next < argc && strpbrk(argv[next], "=<>!") == NULL)
+    {
+        list = argv[next++];
+    }
+    for (; next < argc; next++)
+    {
+        add_filter(argv[next]);
+    }
+
+    if (!strcmp(command, "list"))
+    {
+        list_runs(list);
+    }
+    else if (!strcmp(command, "summary"))
+    {
+        summarize(argv[3], argv[4]);
+    }
+    else if (!strcmp(command, "pareto"))
+    {
+        pareto(argv[3], argv[4]);
+    }
+    else if (!strcmp(command, "intervals"))
+    {
+        list_intervals(list);
+    }
+    else
+    {
+        usage(argv[0]);
+    }
+    results_table_free(&runs);
+    results_table_free(&intervals);
+    return 0;
+}
@@ -0,0 +1,150 @@
+/*
+ * Trace-driven cache simulator
+ * Replays a trace of word accesses through cache.c without running an
+ * LC-2K program.
+ *
+ * The trace is either a compressed binary trace recorded by the simulator
+ * with trace=<file> (see trace.c), or text with one access per line:
+ *     r <addr>          read the word at addr
+ *     w <addr> <data>   write data to the word at addr
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MEMORYSIZE 65536 /* maximum number of words in memory */
+#define MAXLINELENGTH 1000
+
+extern void cache_init(int blockSize, int numSets, int blocksPerSet);
+extern int cache_set_option(const char *name, const char *value);
+extern void cache_replay(int (*next)(int *addr, int *write_flag, int *write_data));
+extern int cache_replay_memory_words(void);
+extern void cache_final_flush(void);
+extern void printStats();
+extern int trace_open_read(const char *path);
+extern int trace_next(int *kind, int *pc, int *addr);
+extern void trace_close_read(void);
+
+// The store kind of a binary trace record, see enum traceKind in trace.c
+#define TRACE_STORE 2
+
+// Backing memory for the cache, starts out all zeros
+static int mem[MEMORYSIZE];
+static int num_mem_accesses = 0;
+static FILE *traceFile;
+static long long traceLine = 0;
+
+int mem_access(int addr, int write_flag, int write_data)
+{
+    ++num_mem_accesses;
+    if (write_flag)
+    {
+        mem[addr] = write_data;
+    }
+    return mem[addr];
+}
+
+int get_num_mem_accesses()
+{
+    return num_mem_accesses;
+}
+
+// cache_replay's source of accesses: the next line of the trace
+static int nextAccess(int *addr, int *write_flag, int *write_data)
+{
+    char line[MAXLINELENGTH];
+    char kind;
+    while (fgets(line, MAXLINELENGTH, traceFile) != NULL)
+    {
+        traceLine++;
+        *write_data = 0;
+        int fields = sscanf(line, " %c %d %d", &kind, addr, write_data);
+        if (fields <= 0)
+        {
+            continue;
+        }
+        if (fields < 2 || (kind != 'r' && kind != 'w') || (kind == 'w' && fields < 3) ||
+            *addr < 0 || *addr >= MEMORYSIZE)
+        {
+            printf("error: bad trace record on line %lld: %s", traceLine, line);
+            exit(2);
+        }
+        *write_flag = kind == 'w';
+        return 1;
+    }
+    return 0;
+}
+
+// cache_replay's source of accesses for binary traces. Binary traces don't
+// carry store data, so stores write 0.
+static int nextBinaryAccess(int *addr, int *write_flag, int *write_data)
+{
+    int kind, pc;
+    if (!trace_next(&kind, &pc, addr))
+    {
+        return 0;
+    }
+    traceLine++;
+    if (*addr < 0 || *addr >= MEMORYSIZE)
+    {
+        printf("error: bad address %d in trace record %lld\n", *addr, traceLine);
+        exit(2);
+    }
+    *write_flag = kind == TRACE_STORE;
+    *write_data = 0;
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 5)
+    {
+        printf("error: usage: %s <trace file> <line size in words> <number of sets> <lines per set> [option=value ...]\n", argv[0]);
+        exit(1);
+    }
+
+    for (int i = 5; i < argc; i++)
+    {
+        char name[MAXLINELENGTH];
+        char *equals = strchr(argv[i], '=');
+        if (equals == NULL || equals - argv[i] >= MAXLINELENGTH)
+        {
+            printf("error: options must look like name=value, got %s\n", argv[i]);
+            exit(1);
+        }
+        memcpy(name, argv[i], equals - argv[i]);
+        name[equals - argv[i]] = '\0';
+        if (cache_set_option(name, equals + 1) != 0)
+        {
+            printf("error: unknown option %s\n", name);
+            exit(1);
+        }
+    }
+
+    cache_init(atoi(argv[2]), atoi(argv[3]), atoi(argv[4]));
+
+    if (trace_open_read(argv[1]))
+    {
+        cache_replay(nextBinaryAccess);
+        trace_close_read();
+    }
+    else
+    {
+        traceFile = fopen(argv[1], "r");
+        if (traceFile == NULL)
+        {
+            printf("error: can't open trace file %s\n", argv[1]);
+            exit(2);
+        }
+        cache_replay(nextAccess);
+        fclose(traceFile);
+    }
+
+    printf("replayed %lld trace records\n", traceLine);
+    cache_final_flush();
+    // A parallel replay only models tags, so its memory traffic comes from the cache's counts
+    printf("$$$ Main memory words accessed: %d\n", get_num_mem_accesses() + cache_replay_memory_words());
+    printStats();
+    return 0;
+}
@@ -0,0 +1,455 @@
+/*
+ * Columnar results store, see results.h
+ *
+ * File layout, all integers little endian:
+ *     "LCRS" magic and format version, 4 bytes each
+ *     the runs table, then the intervals table, each as
+ *         rows and columns, 4 bytes each
+ *         per column: name length (2 bytes) and name, type (1 byte), then
+ *             text: dictionary size (4 bytes), each string as length
+ *                 (2 bytes) and bytes, code width w (1 byte) and w bytes
+ *                 per row
+ *             number: base (8 bytes), width w (1 byte) and w bytes per
+ *                 row of the value minus base
+ * A width of 0 means every row holds the same value.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "results.h"
+
+#define RESULTS_MAGIC 0x5352434C
+#define RESULTS_VERSION 1
+#define MAX_NAME_LENGTH 65535
+#define MAX_ROWS (1 << 28)
+
+static char *copy_string(const char *s)
+{
+    char *copy = malloc(strlen(s) + 1);
+    if (copy != NULL)
+    {
+        strcpy(copy, s);
+    }
+    return copy;
+}
+
+int results_table_init(resultsTable *table, int numColumns, const char *const *names,
+                       const enum resultsType *types)
+{
+    table->rows = 0;
+    table->capacity = 0;
+    table->numColumns = numColumns;
+    table->columns = calloc(numColumns > 0 ? numColumns : 1, sizeof(resultsColumn));
+    if (table->columns == NULL)
+    {
+        return -1;
+    }
+    for (int i = 0; i < numColumns; i++)
+    {
+        table->columns[i].name = copy_string(names[i]);
+        table->columns[i].type = types[i];
+        if (table->columns[i].name == NULL)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void results_table_free(resultsTable *table)
+{
+    for (int i = 0; table->columns != NULL && i < table->numColumns; i++)
+    {
+        resultsColumn *column = &table->columns[i];
+        for (int d = 0; d < column->dictionarySize; d++)
+        {
+            free(column->dictionary[d]);
+        }
+        free(column->dictionary);
+        free(column->values);
+        free(column->name);
+    }
+    free(table->columns);
+    table->columns = NULL;
+    table->numColumns = 0;
+    table->rows = 0;
+    table->capacity = 0;
+}
+
+// Index of text in column's dictionary, adding it if it is new; -1 if out of memory
+static long long dictionary_code(resultsColumn *column, const char *text)
+{
+    // Runs of a sweep mostly repeat their neighbour's configuration
+    for (int d = column->dictionarySize - 1; d >= 0; d--)
+    {
+        if (!strcmp(column->dictionary[d], text))
+        {
+            return d;
+        }
+    }
+    char **grown = realloc(column->dictionary, (column->dictionarySize + 1) * sizeof(char *));
+    if (grown == NULL)
+    {
+        return -1;
+    }
+    column->dictionary = grown;
+    column->dictionary[column->dictionarySize] = copy_string(text);
+    if (column->dictionary[column->dictionarySize] == NULL)
+    {
+        return -1;
+    }
+    return column->dictionarySize++;
+}
+
+// Make room for rows rows in every column of table
+static int reserve_rows(resultsTable *table, int rows)
+{
+    if (rows <= table->capacity)
+    {
+        return 0;
+    }
+    int capacity = table->capacity ? table->capacity : 64;
+    while (capacity < rows)
+    {
+        capacity *= 2;
+    }
+    for (int i = 0; i < table->numColumns; i++)
+    {
+        long long *grown = realloc(table->columns[i].values, capacity * sizeof(long long));
+        if (grown == NULL)
+        {
+            return -1;
+        }
+        table->columns[i].values = grown;
+    }
+    table->capacity = capacity;
+    return 0;
+}
+
+int results_append(resultsTable *table, const char *const *text, const long long *numbers)
+{
+    if (reserve_rows(table, table->rows + 1) != 0)
+    {
+        return -1;
+    }
+    for (int i = 0; i < table->numColumns; i++)
+    {
+        resultsColumn *column = &table->columns[i];
+        long long value = column->type == resultsText ? dictionary_code(column, text[i]) : numbers[i];
+        if (column->type == resultsText && value < 0)
+        {
+            return -1;
+        }
+        column->values[table->rows] = value;
+    }
+    table->rows++;
+    return 0;
+}
+
+int results_column(const resultsTable *table, const char *name)
+{
+    for (int i = 0; i < table->numColumns; i++)
+    {
+        if (!strcmp(table->columns[i].name, name))
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const char *results_text(const resultsTable *table, int column, int row)
+{
+    return table->columns[column].dictionary[table->columns[column].values[row]];
+}
+
+// Bytes needed to hold every value up to range
+static int width_for(unsigned long long range)
+{
+    int width = 0;
+    while (width < 8 && range >> (8 * width) != 0)
+    {
+        width = width ? width * 2 : 1;
+    }
+    return width;
+}
+
+static int write_unsigned(FILE *out, unsigned long long value, int width)
+{
+    unsigned char bytes[8];
+    for (int b = 0; b < width; b++)
+    {
+        bytes[b] = value >> (8 * b) & 0xFF;
+    }
+    return fwrite(bytes, 1, width, out) == (size_t)width ? 0 : -1;
+}
+
+static int write_string(FILE *out, const char *s)
+{
+    size_t length = strlen(s);
+    if (length > MAX_NAME_LENGTH || write_unsigned(out, length, 2) != 0)
+    {
+        return -1;
+    }
+    return fwrite(s, 1, length, out) == length ? 0 : -1;
+}
+
+// Write rows values less base, width bytes each, in one go
+static int write_packed(FILE *out, const long long *values, int rows, long long base, int width)
+{
+    if (width == 0 || rows == 0)
+    {
+        return 0;
+    }
+    unsigned char *packed = malloc((size_t)rows * width);
+    if (packed == NULL)
+    {
+        return -1;
+    }
+    for (int row = 0; row < rows; row++)
+    {
+        unsigned long long offset = (unsigned long long)values[row] - (unsigned long long)base;
+        for (int b = 0; b < width; b++)
+        {
+            packed[(size_t)row * width + b] = offset >> (8 * b) & 0xFF;
+        }
+    }
+    int status = fwrite(packed, width, rows, out) == (size_t)rows ? 0 : -1;
+    free(packed);
+    return status;
+}
+
+static int write_table(FILE *out, const resultsTable *table)
+{
+    if (write_unsigned(out, table->rows, 4) != 0 || write_unsigned(out, table->numColumns, 4) != 0)
+    {
+        return -1;
+    }
+    for (int i = 0; i < table->numColumns; i++)
+    {
+        const resultsColumn *column = &table->columns[i];
+        if (write_string(out, column->name) != 0 || write_unsigned(out, column->type, 1) != 0)
+        {
+            return -1;
+        }
+        long long base = 0;
+        unsigned long long range = 0;
+        if (column->type == resultsText)
+        {
+            if (write_unsigned(out, column->dictionarySize, 4) != 0)
+            {
+                return -1;
+            }
+            for (int d = 0; d < column->dictionarySize; d++)
+            {
+                if (write_string(out, column->dictionary[d]) != 0)
+                {
+                    return -1;
+                }
+            }
+            range = column->dictionarySize ? column->dictionarySize - 1 : 0;
+        }
+        else
+        {
+            long long high = 0;
+            for (int row = 0; row < table->rows; row++)
+            {
+                long long value = column->values[row];
+                base = row == 0 || value < base ? value : base;
+                high = row == 0 || value > high ? value : high;
+            }
+            range = (unsigned long long)high - (unsigned long long)base;
+            if (write_unsigned(out, (unsigned long long)base, 8) != 0)
+            {
+                return -1;
+            }
+        }
+        int width = width_for(range);
+        if (write_unsigned(out, width, 1) != 0 || write_packed(out, column->values, table->rows, base, width) != 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int results_save(const char *path, const resultsTable *runs, const resultsTable *intervals)
+{
+    FILE *out = fopen(path, "wb");
+    if (out == NULL)
+    {
+        return -1;
+    }
+    int status = write_unsigned(out, RESULTS_MAGIC, 4) != 0 || write_unsigned(out, RESULTS_VERSION, 4) != 0 ||
+                         write_table(out, runs) != 0 || write_table(out, intervals) != 0
+                     ? -1
+                     : 0;
+    if (fclose(out) != 0)
+    {
+        status = -1;
+    }
+    return status;
+}
+
+// A loaded file and how far into it reading has got
+typedef struct reader
+{
+    const unsigned char *data;
+    size_t size;
+    size_t at;
+} reader;
+
+// Read a width byte integer; returns -1 past the end of the file
+static int read_unsigned(reader *in, int width, unsigned long long *value)
+{
+    if (in->size - in->at < (size_t)width)
+    {
+        return -1;
+    }
+    *value = 0;
+    for (int b = 0; b < width; b++)
+    {
+        *value |= (unsigned long long)in->data[in->at++] << (8 * b);
+    }
+    return 0;
+}
+
+static char *read_string(reader *in)
+{
+    unsigned long long length;
+    if (read_unsigned(in, 2, &length) != 0 || in->size - in->at < length)
+    {
+        return NULL;
+    }
+    char *s = malloc(length + 1);
+    if (s != NULL)
+    {
+        memcpy(s, in->data + in->at, length);
+        s[length] = '\0';
+        in->at += length;
+    }
+    return s;
+}
+
+static int read_table(reader *in, resultsTable *table)
+{
+    unsigned long long rows, numColumns;
+    table->columns = NULL;
+    table->numColumns = 0;
+    if (read_unsigned(in, 4, &rows) != 0 || read_unsigned(in, 4, &numColumns) != 0 || rows > MAX_ROWS ||
+        numColumns > in->size)
+    {
+        return -1;
+    }
+    table->rows = 0;
+    table->capacity = 0;
+    table->columns = calloc(numColumns ? numColumns : 1, sizeof(resultsColumn));
+    if (table->columns == NULL)
+    {
+        return -1;
+    }
+    table->numColumns = numColumns;
+    if (reserve_rows(table, rows) != 0)
+    {
+        return -1;
+    }
+    table->rows = rows;
+    for (int i = 0; i < table->numColumns; i++)
+    {
+        resultsColumn *column = &table->columns[i];
+        unsigned long long type, count, base = 0, width;
+        column->name = read_string(in);
+        if (column->name == NULL || read_unsigned(in, 1, &type) != 0 || type > resultsText)
+        {
+            return -1;
+        }
+        column->type = type;
+        if (column->type == resultsText)
+        {
+            if (read_unsigned(in, 4, &count) != 0 || count > in->size)
+            {
+                return -1;
+            }
+            column->dictionary = calloc(count ? count : 1, sizeof(char *));
+            if (column->dictionary == NULL)
+            {
+                return -1;
+            }
+            for (; column->dictionarySize < (int)count; column->dictionarySize++)
+            {
+                column->dictionary[column->dictionarySize] = read_string(in);
+                if (column->dictionary[column->dictionarySize] == NULL)
+                {
+                    return -1;
+                }
+            }
+        }
+        else if (read_unsigned(in, 8, &base) != 0)
+        {
+            return -1;
+        }
+        // A width of 0 stores nothing per row: every row holds base
+        if (read_unsigned(in, 1, &width) != 0 || width > 8 || (width && (in->size - in->at) / width < rows))
+        {
+            return -1;
+        }
+        for (int row = 0; row < table->rows; row++)
+        {
+            unsigned long long offset = 0;
+            read_unsigned(in, width, &offset);
+            column->values[row] = (long long)(base + offset);
+            if (column->type == resultsText && (unsigned long long)column->values[row] >= count)
+            {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+int results_load(const char *path, resultsTable *runs, resultsTable *intervals)
+{
+    FILE *in = fopen(path, "rb");
+    runs->columns = NULL;
+    intervals->columns = NULL;
+    if (in == NULL)
+    {
+        return -1;
+    }
+    reader r = {NULL, 0, 0};
+    unsigned char *data = NULL;
+    if (fseek(in, 0, SEEK_END) == 0)
+    {
+        long size = ftell(in);
+        r.size = size > 0 ? size : 0;
+        data = malloc(r.size ? r.size : 1);
+        rewind(in);
+        if (data != NULL && fread(data, 1, r.size, in) != r.size)
+        {
+            free(data);
+            data = NULL;
+        }
+    }
+    fclose(in);
+    if (data == NULL)
+    {
+        return -1;
+    }
+    r.data = data;
+
+    unsigned long long magic, version;
+    int status = read_unsigned(&r, 4, &magic) != 0 || magic != RESULTS_MAGIC ||
+                         read_unsigned(&r, 4, &version) != 0 || version != RESULTS_VERSION ||
+                         read_table(&r, runs) != 0 || read_table(&r, intervals) != 0
+                     ? -1
+                     : 0;
+    free(data);
+    if (status != 0)
+    {
+        results_table_free(runs);
+        results_table_free(intervals);
+    }
+    return status;
+}
@@ -0,0 +1,64 @@
+/*
+ * Columnar results store for cache sweeps
+ *
+ * A store holds two tables. runs has one row per simulated configuration,
+ * and intervals has one row per interval of every run, tied to its run by
+ * the run column. Text columns, which hold the configuration (program and
+ * options), are dictionary encoded: each distinct value is stored once and
+ * rows store its index in as few bytes as the dictionary needs. Number
+ * columns store their smallest value and each row's offset from it, also
+ * in as few bytes as the range needs. A store is loaded column by column
+ * with no parsing, so queries over tens of thousands of runs take
+ * milliseconds.
+ */
+
+#ifndef RESULTS_H
+#define RESULTS_H
+
+enum resultsType
+{
+    resultsNumber,
+    resultsText
+};
+
+typedef struct resultsColumn
+{
+    char *name;
+    enum resultsType type;
+    // One value per row; for text, the index of the row's string in dictionary
+    long long *values;
+    char **dictionary;
+    int dictionarySize;
+} resultsColumn;
+
+typedef struct resultsTable
+{
+    int rows;
+    int capacity;
+    int numColumns;
+    resultsColumn *columns;
+} resultsTable;
+
+// Set table up, empty, with the given columns. Returns 0, or -1 if out of memory.
+int results_table_init(resultsTable *table, int numColumns, const char *const *names,
+                       const enum resultsType *types);
+void results_table_free(resultsTable *table);
+
+/*
+ * Append a row. Column i takes text[i] if it is a text column and
+ * numbers[i] otherwise; the other array's entry is ignored. Returns 0, or
+ * -1 if out of memory.
+ */
+int results_append(resultsTable *table, const char *const *text, const long long *numbers);
+
+// Index of the column called name, or -1 if there is none
+int results_column(const resultsTable *table, const char *name);
+
+// The text of a text column's row
+const char *results_text(const resultsTable *table, int column, int row);
+
+// Write a store, or read one into two uninitialized tables. 0 on success, -1 on error.
+int results_save(const char *path, const resultsTable *runs, const resultsTable *intervals);
+int results_load(const char *path, resultsTable *runs, resultsTable *intervals);
+
+#endif
@@ -0,0 +1,314 @@
+/*
+ * Cache configuration sweep
+ * Runs one LC-2K program through every cache geometry up to the given
+ * limits in a single process, using libcachesim, and prints one CSV line
+ * per configuration:
+ *     ./sweep program.mc <max block size> <max sets> <max ways> [name=value ...]
+ * Block size, sets and ways all step through powers of 2 from 1, skipping
+ * caches larger than the model allows. The options apply to every run, and
+ * an option given as name=a|b|... is swept too: every geometry runs with
+ * every combination of the alternatives, which get a CSV column each.
+ *
+ * results=<file> also writes every run, and the statistics of each of its
+ * intervals (see the interval option), to a columnar results store for the
+ * query tool; see results.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libcachesim.h"
+#include "results.h"
+
+#define MAX_CACHE_SIZE 256
+#define MAX_OPTIONS 64
+#define MAX_ALTERNATIVES 64
+#define MAXLINELENGTH 1000
+// Runs that don't halt within this many instructions are reported as failed
+#define INSTRUCTION_LIMIT 100000000LL
+
+// An option of the sweep and the values it takes
+typedef struct sweepOption
+{
+    char name[MAXLINELENGTH];
+    int numValues;
+    char *values[MAX_ALTERNATIVES];
+    // The value of the run in progress
+    int current;
+} sweepOption;
+
+static sweepOption options[MAX_OPTIONS];
+static int numOptions = 0;
+// Each option's name=value in the run in progress, as cachesim_run takes them
+static char settings[MAX_OPTIONS][2 * MAXLINELENGTH];
+
+// Results store tables, and the row the run in progress will get
+static resultsTable runs;
+static resultsTable intervals;
+static int runRow = 0;
+
+enum runColumn
+{
+    runProgram,
+    runBlockSize,
+    runNumSets,
+    runBlocksPerSet,
+    runInstructions,
+    runHits,
+    runMisses,
+    runWritebacks,
+    runDirtyBlocks,
+    runMemAccesses,
+    runStatus,
+    NUM_RUN_COLUMNS
+};
+
+static const char *runColumnNames[NUM_RUN_COLUMNS] = {
+    "program", "blockSize", "numSets", "blocksPerSet", "instructions", "hits",
+    "misses", "writebacks", "dirtyBlocks", "memAccesses", "status"};
+
+static const char *intervalColumnNames[] = {
+    "run", "interval", "accesses", "instructions", "hits", "misses", "writebacks", "dirtyBlocks"};
+#define NUM_INTERVAL_COLUMNS (int)(sizeof(intervalColumnNames) / sizeof(intervalColumnNames[0]))
+
+static void out_of_memory(void)
+{
+    printf("error: out of memory\n");
+    exit(1);
+}
+
+// Split name=a|b|... into an option and its alternatives
+static void add_option(char *arg)
+{
+    char *equals = strchr(arg, '=');
+    if (equals == NULL || equals - arg >= MAXLINELENGTH || strlen(equals + 1) >= MAXLINELENGTH)
+    {
+        printf("error: options must look like name=value, got %s\n", arg);
+        exit(1);
+    }
+    if (numOptions == MAX_OPTIONS)
+    {
+        printf("error: at most %d options\n", MAX_OPTIONS);
+        exit(1);
+    }
+    sweepOption *option = &options[numOptions++];
+    memcpy(option->name, arg, equals - arg);
+    option->name[equals - arg] = '\0';
+    char *value = equals + 1;
+    for (;;)
+    {
+        if (option->numValues == MAX_ALTERNATIVES)
+        {
+            printf("error: at most %d alternatives for %s\n", MAX_ALTERNATIVES, option->name);
+            exit(1);
+        }
+        option->values[option->numValues++] = value;
+        char *bar = strchr(value, '|');
+        if (bar == NULL)
+        {
+            break;
+        }
+        *bar = '\0';
+        value = bar + 1;
+    }
+}
+
+// Move on to the next combination of alternatives; 0 once they are all done
+static int next_combination(void)
+{
+    for (int i = numOptions - 1; i >= 0; i--)
+    {
+        if (++options[i].current < options[i].numValues)
+        {
+            return 1;
+        }
+        options[i].current = 0;
+    }
+    return 0;
+}
+
+// libcachesim's interval callback: every interval goes to the results store
+static void store_interval(const cachesimInterval *interval, void *user)
+{
+    (void)user;
+    long long numbers[NUM_INTERVAL_COLUMNS] = {runRow, interval->interval, interval->accesses,
+                                               interval->instructions, interval->hits, interval->misses,
+                                               interval->writebacks, interval->dirtyBlocks};
+    if (results_append(&intervals, NULL, numbers) != 0)
+    {
+        out_of_memory();
+    }
+}
+
+// Set up the results store tables: the run columns, with the options after the geometry
+static void init_results(void)
+{
+    const char *names[NUM_RUN_COLUMNS + MAX_OPTIONS];
+    enum resultsType types[NUM_RUN_COLUMNS + MAX_OPTIONS];
+    int n = 0;
+    for (int c = 0; c < NUM_RUN_COLUMNS; c++)
+    {
+        names[n] = runColumnNames[c];
+        types[n++] = c == runProgram || c == runStatus ? resultsText : resultsNumber;
+        for (int i = 0; c == runBlocksPerSet && i < numOptions; i++)
+        {
+            names[n] = options[i].name;
+            types[n++] = resultsText;
+        }
+    }
+    enum resultsType intervalTypes[NUM_INTERVAL_COLUMNS];
+    for (int c = 0; c < NUM_INTERVAL_COLUMNS; c++)
+    {
+        intervalTypes[c] = resultsNumber;
+    }
+    if (results_table_init(&runs, n, names, types) != 0 ||
+        results_table_init(&intervals, NUM_INTERVAL_COLUMNS, intervalColumnNames, intervalTypes) != 0)
+    {
+        out_of_memory();
+    }
+}
+
+static void store_run(const char *program, int bs, int ns, int bps, const cachesimResults *r, int status)
+{
+    const char *text[NUM_RUN_COLUMNS + MAX_OPTIONS];
+    long long numbers[NUM_RUN_COLUMNS + MAX_OPTIONS];
+    long long metrics[NUM_RUN_COLUMNS] = {0, bs, ns, bps, r->instructions, r->hits, r->misses,
+                                          r->writebacks, r->dirtyBlocks, r->memAccesses, 0};
+    int n = 0;
+    for (int c = 0; c < NUM_RUN_COLUMNS; c++)
+    {
+        text[n] = c == runProgram ? program : (status ? "failed" : "halted");
+        numbers[n++] = metrics[c];
+        for (int i = 0; c == runBlocksPerSet && i < numOptions; i++)
+        {
+            text[n] = options[i].values[options[i].current];
+            numbers[n++] = 0;
+        }
+    }
+    if (results_append(&runs, text, numbers) != 0)
+    {
+        out_of_memory();
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 5)
+    {
+        printf("error: usage: %s <machine-code file> <max block size> <max sets> <max ways> [name=value ...]\n",
+               argv[0]);
+        exit(1);
+    }
+    int maxBlockSize = atoi(argv[2]);
+    int maxSets = atoi(argv[3]);
+    int maxWays = atoi(argv[4]);
+    const char *resultsFile = NULL;
+    for (int i = 5; i < argc; i++)
+    {
+        if (!strncmp(argv[i], "results=", 8))
+        {
+            resultsFile = argv[i] + 8;
+        }
+        else
+        {
+            add_option(argv[i]);
+        }
+    }
+
+    // An option the library refuses would fail every run, so stop before the first
+    for (int i = 0; i < numOptions; i++)
+    {
+        for (int v = 0; v < options[i].numValues; v++)
+        {
+            sprintf(settings[i], "%s=%s", options[i].name, options[i].values[v]);
+            if (cachesim_check_option(settings[i]) != 0)
+            {
+                printf("error: libcachesim can't run with option %s: %s\n", settings[i], cachesim_error());
+                exit(1);
+            }
+        }
+    }
+
+    cachesimArena *arena = cachesim_arena_create(1);
+    if (arena == NULL)
+    {
+        out_of_memory();
+    }
+    cachesimContext *context = cachesim_context(arena, 0);
+    if (cachesim_load(context, argv[1]) != 0)
+    {
+        printf("error: can't load %s\n", argv[1]);
+        exit(1);
+    }
+    cachesim_set_limit(context, INSTRUCTION_LIMIT);
+    if (resultsFile != NULL)
+    {
+        init_results();
+        cachesim_set_interval_callback(context, store_interval, NULL);
+    }
+
+    printf("blockSize,numSets,blocksPerSet,");
+    for (int i = 0; i < numOptions; i++)
+    {
+        if (options[i].numValues > 1)
+        {
+            printf("%s,", options[i].name);
+        }
+    }
+    printf("instructions,hits,misses,writebacks,dirtyBlocks,memAccesses,status\n");
+    const char *runOptions[MAX_OPTIONS];
+    for (int bs = 1; bs <= maxBlockSize; bs *= 2)
+    {
+        for (int ns = 1; ns <= maxSets; ns *= 2)
+        {
+            for (int bps = 1; bps <= maxWays; bps *= 2)
+            {
+                if (ns * bps > MAX_CACHE_SIZE)
+                {
+                    continue;
+                }
+                do
+                {
+                    for (int i = 0; i < numOptions; i++)
+                    {
+                        sprintf(settings[i], "%s=%s", options[i].name, options[i].values[options[i].current]);
+                        runOptions[i] = settings[i];
+                    }
+                    cachesimResults r = {0};
+                    int status = cachesim_run(context, bs, ns, bps, numOptions, runOptions, &r);
+                    // A run that failed without results was refused by the cache model: an
+                    // invalid combination of settings, or verify=1 finding a divergence
+                    if (status && r.instructions == 0)
+                    {
+                        printf("error: %s\n", cachesim_error());
+                        exit(1);
+                    }
+                    printf("%d,%d,%d,", bs, ns, bps);
+                    for (int i = 0; i < numOptions; i++)
+                    {
+                        if (options[i].numValues > 1)
+                        {
+                            printf("%s,", options[i].values[options[i].current]);
+                        }
+                    }
+                    printf("%lld,%d,%d,%d,%d,%d,%s\n", r.instructions, r.hits, r.misses,
+                           r.writebacks, r.dirtyBlocks, r.memAccesses, status ? "failed" : "halted");
+                    if (resultsFile != NULL)
+                    {
+                        store_run(argv[1], bs, ns, bps, &r, status);
+                        runRow++;
+                    }
+                } while (next_combination());
+            }
+        }
+    }
+
+    if (resultsFile != NULL && results_save(resultsFile, &runs, &intervals) != 0)
+    {
+        printf("error: can't write %s\n", resultsFile);
+        exit(1);
+    }
+    cachesim_arena_destroy(arena);
+    return 0;
+}
@@ -0,0 +1,344 @@
+/*
+ * Compressed memory-access traces
+ * Written by the LC-2K simulator (trace=<file>) and replayed by replay.c.
+ *
+ * A trace file is the 8 byte magic "LC2KTRC1" followed by blocks. Each
+ * block is a 4 byte little-endian record count, a 4 byte little-endian
+ * payload length and the payload. Within a block every record is
+ *     varint((zigzag(pc - previous pc) << 2) | kind)
+ * followed, for loads and stores only, by
+ *     varint(zigzag(addr - previous load/store addr))
+ * Fetches don't store an address, it is always the pc. The deltas restart
+ * from 0 in every block, so blocks decode independently. Sequential code
+ * costs 1 byte per fetch and typical loads and stores 2-3 bytes, against
+ * 12 bytes for a raw (pc, addr, flag) record.
+ */
+
+// For pthreads under -std=c99
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TRACE_MAGIC "LC2KTRC1"
+#define TRACE_BLOCK_RECORDS 65536
+// Two varints of at most 5 bytes each
+#define TRACE_MAX_RECORD_BYTES 10
+#define TRACE_RAW_RECORD_BYTES 12
+
+// Use these for the kind of a trace record
+enum traceKind
+{
+    traceFetch,
+    traceLoad,
+    traceStore
+};
+
+/*
+ * Writing
+ */
+static FILE *writeFile = NULL;
+static unsigned char writePayload[TRACE_BLOCK_RECORDS * TRACE_MAX_RECORD_BYTES];
+static int writeBytes;
+static int writeRecords;
+static int writeLastPc;
+static int writeLastAddr;
+static long long totalRecords;
+static long long totalBytes;
+
+static unsigned int zigzag(int value)
+{
+    return ((unsigned int)value << 1) ^ (unsigned int)(value >> 31);
+}
+
+static int unzigzag(unsigned int value)
+{
+    return (int)(value >> 1) ^ -(int)(value & 1);
+}
+
+static void put_varint(unsigned int value)
+{
+    while (value >= 0x80)
+    {
+        writePayload[writeBytes++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    writePayload[writeBytes++] = (unsigned char)value;
+}
+
+static void put_u32(unsigned char *out, unsigned int value)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        out[i] = (unsigned char)(value >> (8 * i));
+    }
+}
+
+static void flush_block(void)
+{
+    unsigned char header[8];
+    if (writeRecords == 0)
+    {
+        return;
+    }
+    put_u32(header, writeRecords);
+    put_u32(header + 4, writeBytes);
+    if (fwrite(header, 1, 8, writeFile) != 8 ||
+        fwrite(writePayload, 1, writeBytes, writeFile) != (size_t)writeBytes)
+    {
+        printf("error: failed to write trace\n");
+        exit(1);
+    }
+    totalBytes += 8 + writeBytes;
+    writeRecords = 0;
+    writeBytes = 0;
+    writeLastPc = 0;
+    writeLastAddr = 0;
+}
+
+// Start recording a trace to path
+void trace_open_write(const char *path)
+{
+    writeFile = fopen(path, "wb");
+    if (writeFile == NULL)
+    {
+        printf("error: can't open trace file %s\n", path);
+        exit(1);
+    }
+    if (fwrite(TRACE_MAGIC, 1, 8, writeFile) != 8)
+    {
+        printf("error: failed to write trace\n");
+        exit(1);
+    }
+    totalRecords = 0;
+    totalBytes = 8;
+    writeRecords = 0;
+    writeBytes = 0;
+    writeLastPc = 0;
+    writeLastAddr = 0;
+}
+
+// Append one access; addr is ignored for fetches
+void trace_record(int kind, int pc, int addr)
+{
+    put_varint(zigzag(pc - writeLastPc) << 2 | kind);
+    writeLastPc = pc;
+    if (kind != traceFetch)
+    {
+        put_varint(zigzag(addr - writeLastAddr));
+        writeLastAddr = addr;
+    }
+    totalRecords++;
+    if (++writeRecords == TRACE_BLOCK_RECORDS)
+    {
+        flush_block();
+    }
+}
+
+// Finish the trace and report how well it compressed
+void trace_close_write(void)
+{
+    flush_block();
+    fclose(writeFile);
+    writeFile = NULL;
+    printf("trace: %lld records in %lld bytes, %.1fx smaller than raw records\n",
+           totalRecords, totalBytes,
+           totalBytes ? (double)totalRecords * TRACE_RAW_RECORD_BYTES / totalBytes : 0.0);
+}
+
+/*
+ * Reading. A background thread reads and decodes the next block into one
+ * buffer while the caller consumes the other, so replay doesn't wait on
+ * I/O or varint decoding.
+ */
+typedef struct traceBuffer
+{
+    int pc[TRACE_BLOCK_RECORDS];
+    int addr[TRACE_BLOCK_RECORDS];
+    unsigned char kind[TRACE_BLOCK_RECORDS];
+    int count;
+    // Set by the decoder when the buffer may be consumed
+    int ready;
+    // Set on the buffer after the last block
+    int end;
+} traceBuffer;
+
+static FILE *readFile = NULL;
+static traceBuffer readBuffers[2];
+static unsigned char readPayload[TRACE_BLOCK_RECORDS * TRACE_MAX_RECORD_BYTES];
+static pthread_t readThread;
+static pthread_mutex_t readLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t readChanged = PTHREAD_COND_INITIALIZER;
+// Only touched by the consumer: the buffer being read, how far into it,
+// and how many records it holds (-1 before the first buffer arrives)
+static int readCurrent;
+static int readPosition;
+static int readCount;
+static int readEnded;
+
+static unsigned int get_u32(const unsigned char *in)
+{
+    return in[0] | in[1] << 8 | in[2] << 16 | (unsigned int)in[3] << 24;
+}
+
+static unsigned int get_varint(const unsigned char **in, const unsigned char *end)
+{
+    unsigned int value = 0;
+    for (int shift = 0; *in < end && shift < 35; shift += 7)
+    {
+        unsigned char byte = *(*in)++;
+        value |= (unsigned int)(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+        {
+            return value;
+        }
+    }
+    printf("error: corrupt trace block\n");
+    exit(2);
+}
+
+// Decode the next block of the file into buffer; returns 0 at the end of the file
+static int decode_block(traceBuffer *buffer)
+{
+    unsigned char header[8];
+    size_t got = fread(header, 1, 8, readFile);
+    if (got == 0)
+    {
+        return 0;
+    }
+    unsigned int count = get_u32(header);
+    unsigned int bytes = get_u32(header + 4);
+    if (got != 8 || count > TRACE_BLOCK_RECORDS || bytes > sizeof(readPayload) ||
+        fread(readPayload, 1, bytes, readFile) != bytes)
+    {
+        printf("error: truncated trace\n");
+        exit(2);
+    }
+    const unsigned char *in = readPayload;
+    const unsigned char *end = readPayload + bytes;
+    int pc = 0;
+    int addr = 0;
+    for (unsigned int i = 0; i < count; i++)
+    {
+        unsigned int head = get_varint(&in, end);
+        pc += unzigzag(head >> 2);
+        buffer->kind[i] = head & 3;
+        if (buffer->kind[i] != traceFetch)
+        {
+            addr += unzigzag(get_varint(&in, end));
+        }
+        buffer->pc[i] = pc;
+        buffer->addr[i] = buffer->kind[i] == traceFetch ? pc : addr;
+    }
+    buffer->count = count;
+    return 1;
+}
+
+static void *decode_blocks(void *arg)
+{
+    (void)arg;
+    for (int next = 0;; next ^= 1)
+    {
+        traceBuffer *buffer = &readBuffers[next];
+        pthread_mutex_lock(&readLock);
+        while (buffer->ready)
+        {
+            pthread_cond_wait(&readChanged, &readLock);
+        }
+        pthread_mutex_unlock(&readLock);
+
+        int more = decode_block(buffer);
+
+        pthread_mutex_lock(&readLock);
+        buffer->end = !more;
+        buffer->ready = 1;
+        pthread_cond_broadcast(&readChanged);
+        pthread_mutex_unlock(&readLock);
+        if (!more)
+        {
+            return NULL;
+        }
+    }
+}
+
+/*
+ * Open a trace for trace_next. Returns 0 if path is not a binary trace,
+ * so the caller can fall back to another format.
+ */
+int trace_open_read(const char *path)
+{
+    char magic[8];
+    readFile = fopen(path, "rb");
+    if (readFile == NULL)
+    {
+        printf("error: can't open trace file %s\n", path);
+        exit(2);
+    }
+    if (fread(magic, 1, 8, readFile) != 8 || memcmp(magic, TRACE_MAGIC, 8))
+    {
+        fclose(readFile);
+        readFile = NULL;
+        return 0;
+    }
+    readBuffers[0].ready = 0;
+    readBuffers[1].ready = 0;
+    readCurrent = 0;
+    readPosition = -1;
+    readCount = -1;
+    readEnded = 0;
+    if (pthread_create(&readThread, NULL, decode_blocks, NULL) != 0)
+    {
+        printf("error: can't start trace reader thread\n");
+        exit(1);
+    }
+    return 1;
+}
+
+// Read the next record; returns 0 at the end of the trace
+int trace_next(int *kind, int *pc, int *addr)
+{
+    traceBuffer *buffer = &readBuffers[readCurrent];
+    if (readPosition == readCount)
+    {
+        if (readEnded)
+        {
+            return 0;
+        }
+        pthread_mutex_lock(&readLock);
+        if (readCount >= 0)
+        {
+            // Hand the used buffer back to the decoder and move to the other one
+            buffer->ready = 0;
+            pthread_cond_broadcast(&readChanged);
+            readCurrent ^= 1;
+            buffer = &readBuffers[readCurrent];
+        }
+        while (!buffer->ready)
+        {
+            pthread_cond_wait(&readChanged, &readLock);
+        }
+        readEnded = buffer->end;
+        readCount = buffer->end ? 0 : buffer->count;
+        readPosition = 0;
+        pthread_mutex_unlock(&readLock);
+        if (readCount == 0)
+        {
+            return trace_next(kind, pc, addr);
+        }
+    }
+    *kind = buffer->kind[readPosition];
+    *pc = buffer->pc[readPosition];
+    *addr = buffer->addr[readPosition];
+    readPosition++;
+    return 1;
+}
+
+// Stop reading; the whole trace must have been read by trace_next
+void trace_close_read(void)
+{
+    pthread_join(readThread, NULL);
+    fclose(readFile);
+    readFile = NULL;
+}